@@ -7,7 +7,21 @@
 #include <stack>
 #include <vector>
 #include <limits>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <type_traits>
 #include <assert.h>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
 
 template<typename ty, int dims>
 struct DataType
@@ -69,7 +83,7 @@ inline double EuclideanDistance(const ValType1& p1, const ValType2& p2)
 }
 
 template<typename ty, int dims>
-inline double EuclideanDistance(const std::array<ty, dims>& p1, const DataType<ty, dims>& p2)
+inline double EuclideanDistance(const typename DataType<ty, dims>::data_type& p1, const DataType<ty, dims>& p2)
 {
 	double ret = 0;
 	for (int i = 0; i < dims; ++i)
@@ -80,23 +94,304 @@ inline double EuclideanDistance(const std::array<ty, dims>& p1, const DataType<t
 }
 
 template<typename ty, int dims>
-inline double EuclideanDistance(const DataType<ty, dims>& p1, const std::array<ty, dims>& p2)
+inline double EuclideanDistance(const DataType<ty, dims>& p1, const typename DataType<ty, dims>::data_type& p2)
 {
 	return EuclideanDistance(p2, p1);
 }
 
+//޷, λǰ; ƽľȷۼ(MSVC û __int128)
+template<int Limbs>
+struct WideUInt
+{
+	static_assert(Limbs >= 2, "at least 128 bits.");
+	std::array<std::uint64_t, Limbs> limb;
+
+	WideUInt()
+	{
+		limb.fill(0);
+	}
+	static WideUInt Max()
+	{
+		WideUInt ret;
+		ret.limb.fill(~std::uint64_t(0));
+		return ret;
+	}
+
+	// a * b  128 λ˻
+	void AddProduct(std::uint64_t a, std::uint64_t b)
+	{
+		if (((a | b) >> 32) == 0)
+		{
+			Add(a * b, 0);
+			return;
+		}
+		const std::uint64_t mask = 0xffffffff;
+		std::uint64_t lo_lo = (a & mask) * (b & mask), hi_lo = (a >> 32) * (b & mask);
+		std::uint64_t lo_hi = (a & mask) * (b >> 32), hi_hi = (a >> 32) * (b >> 32);
+		std::uint64_t cross = (lo_lo >> 32) + (hi_lo & mask) + lo_hi;
+		Add((cross << 32) | (lo_lo & mask), (hi_lo >> 32) + (cross >> 32) + hi_hi);
+	}
+
+	void Add(std::uint64_t lo, std::uint64_t hi)
+	{
+		limb[0] += lo;
+		std::uint64_t carry = limb[0] < lo;
+		limb[1] += hi;
+		std::uint64_t next = limb[1] < hi;
+		limb[1] += carry;
+		carry = next + (limb[1] < carry);
+		for (int i = 2; i < Limbs && carry; ++i)
+		{
+			limb[i] += carry;
+			carry = limb[i] < carry;
+		}
+	}
+
+	double ToDouble() const
+	{
+		double ret = 0;
+		for (int i = Limbs - 1; i >= 0; --i)
+			ret = ret * 18446744073709551616.0 + (double)limb[i];
+		return ret;
+	}
+
+	friend bool operator<(const WideUInt& l, const WideUInt& r)
+	{
+		for (int i = Limbs - 1; i >= 0; --i)
+			if (l.limb[i] != r.limb[i])
+				return l.limb[i] < r.limb[i];
+		return false;
+	}
+	friend bool operator==(const WideUInt& l, const WideUInt& r)
+	{
+		return l.limb == r.limb;
+	}
+};
+
+//ƽۼӷʽ; 갴 double 
+template<typename ty, typename Enable = void>
+struct SquaredDistanceTraits
+{
+	typedef double type;
+
+	static type Max()
+	{
+		return std::numeric_limits<double>::max();
+	}
+	static void Add(type& acc, ty a, ty b)
+	{
+		double diff = (double)a - (double)b;
+		acc += diff * diff;
+	}
+	static double ToDouble(const type& value)
+	{
+		return value;
+	}
+};
+
+//: ľֵ 64 λ޷, ƽ WideUInt ۼ, ȷ˳޹
+//32 λÿƽ 64 λ,  128 λ; 64 λÿɴ 128 λ,  192 λ
+template<typename ty>
+struct SquaredDistanceTraits<ty, typename std::enable_if<std::is_integral<ty>::value>::type>
+{
+	typedef WideUInt<sizeof(ty) <= 4 ? 2 : 3> type;
+
+	static type Max()
+	{
+		return type::Max();
+	}
+	static void Add(type& acc, ty a, ty b)
+	{
+		std::uint64_t diff = a < b ? (std::uint64_t)b - (std::uint64_t)a : (std::uint64_t)a - (std::uint64_t)b;
+		acc.AddProduct(diff, diff);
+	}
+	static double ToDouble(const type& value)
+	{
+		return value.ToDouble();
+	}
+};
+
+template<typename ValType1, typename ValType2>
+inline typename SquaredDistanceTraits<typename ValType2::value_type>::type SquaredEuclideanDistance(const ValType1& p1, const ValType2& p2)
+{
+	typedef SquaredDistanceTraits<typename ValType2::value_type> Traits;
+	typename Traits::type ret = typename Traits::type();
+	for (size_t i = 0; i < p2.size(); ++i)
+		Traits::Add(ret, p1[i], p2[i]);
+	return ret;
+}
+
+inline void PrefetchRead(const void* ptr)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_prefetch(static_cast<const char*>(ptr), _MM_HINT_T0);
+#elif defined(__GNUC__)
+	__builtin_prefetch(ptr);
+#else
+	(void)ptr;
+#endif
+}
+
+//func(t)  threads ߳ϸִһ, t Ϊ߳, 0 Ϊ߳
+template<typename Func>
+inline void RunOnThreads(int threads, Func&& func)
+{
+	std::vector<std::thread> pool;
+	for (int t = 1; t < threads; ++t)
+		pool.emplace_back([&func, t] { func(t); });
+	func(0);
+	for (auto& thread : pool)
+		thread.join();
+}
+
+// [0, size)  chunk ֿ,  threads ̶̬߳ȡ, func(begin, end) һ; threads <= 0 ʱȡӲ߳
+template<typename Func>
+inline void ParallelChunks(int size, int chunk, int threads, Func&& func)
+{
+	if (threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	std::atomic<int> next{ 0 };
+	RunOnThreads(threads, [&](int)
+	{
+		for (int begin = next.fetch_add(chunk); begin < size; begin = next.fetch_add(chunk))
+			func(begin, std::min(size, begin + chunk));
+	});
+}
+
 template<typename ValType>
 inline bool dim_compare(const ValType& l, const ValType& r, size_t dim)
 {
 	return l[dim] < r[dim];
 }
 
+enum class ExportFormat
+{
+	Matlab,
+	Svg,
+	Binary, //"KDT1"ͷ + 򶨳ڵ¼
+};
+
+struct ExportOptions
+{
+	ExportFormat format = ExportFormat::Matlab;
+	std::array<int, 2> projection = { { -1, -1 } }; //Ϊά, ֵȡά 0  1(һάΪά 0)
+	//, һȡİΧ; Ĭϵȫ
+	std::array<double, 2> x_range = { { -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() } };
+	std::array<double, 2> y_range = { { -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() } };
+	int max_depth = std::numeric_limits<int>::max();
+	double point_radius = 1; // Svg ʹ
+};
+
+enum class NodeLayout
+{
+	Heap,			//ʱ new, λɷ
+	DepthFirst,
+	BreadthFirst,
+	VanEmdeBoas,	//ݹֿ, Ҷ· O(log_B n) 
+	Blocked,		//ڵֿ: ÿΪһҳڵȫ, , ߽粻ҳ
+};
+
+//ѹд洢 k ͼ, кΪԭе±
+struct KnnGraph
+{
+	std::vector<size_t> offsets;	// i еھλ [offsets[i], offsets[i + 1]), ; ɳ int Χ
+	std::vector<int> indices;
+	std::vector<double> sq_dists;	//ƽ
+};
+
+enum class BuildMethod
+{
+	Median,		//㰴άȡλ, ƽ
+	Morton,		//Morton , ,  KdTree::BuildQuality
+};
+
+//, ޹Ĳѯʹ
+struct AcceptAll
+{
+	bool operator()(int) const
+	{
+		return true;
+	}
+};
+
+//ժҪĹ: λ mask ޽ʱ,  predicate(ind) ж
+//ȵ KdTree::BuildFilterSummary
+template<typename Predicate>
+struct SummaryFilter
+{
+	std::uint32_t mask;
+	Predicate predicate;
+
+	bool operator()(int ind) const
+	{
+		return predicate(ind);
+	}
+};
+
+template<typename Predicate>
+inline SummaryFilter<Predicate> MakeSummaryFilter(std::uint32_t mask, Predicate predicate)
+{
+	return SummaryFilter<Predicate>{ mask, std::move(predicate) };
+}
+
+//ѯʱ: ǽԤ/ʽڵԤ, һþµ
+//ʱÿ clock_interval νڵʲŶȡһ; һѯɹͬһ, ɿ̹߳
+struct QueryDeadline
+{
+	typedef std::chrono::steady_clock clock;
+
+	clock::time_point until = clock::time_point::max();
+	long long node_budget = std::numeric_limits<long long>::max();
+	int clock_interval = 64;
+
+	QueryDeadline() = default;
+	//budget Թʱ
+	explicit QueryDeadline(clock::duration budget, long long nodes = std::numeric_limits<long long>::max())
+		:until(clock::now() + budget), node_budget(nodes) {}
+
+	static QueryDeadline Nodes(long long nodes)
+	{
+		QueryDeadline ret;
+		ret.node_budget = nodes;
+		return ret;
+	}
+
+	//һνڵ
+	void Visit()
+	{
+		if (++visited >= node_budget)
+			expired = true;
+		if (--until_clock <= 0)
+		{
+			until_clock = clock_interval;
+			if (clock::now() >= until)
+				expired = true;
+		}
+	}
+
+	bool Expired() const
+	{
+		return expired;
+	}
+
+	long long Visited() const
+	{
+		return visited;
+	}
+
+private:
+	long long visited = 0;
+	int until_clock = 0; //״ηʼȡʱ, ԤΪ 0 ʱЧ
+	bool expired = false;
+};
+
 template<typename ValType>
 struct KdNode
 {
 	KdNode* parent;
 	ValType val;
 	int split_dim;
+	std::uint32_t summary = ~0u; //еλĲ,  KdTree::BuildFilterSummary; ռ split_dim , ڵ㲻
 	std::array<KdNode*, 2> children;
 
 	KdNode(KdNode* Parent, ValType Val, int Split_dim)
@@ -109,14 +404,38 @@ template<typename ValType>
 struct KdTree
 {
 	typedef KdNode<ValType> NodeType;
+	typedef SquaredDistanceTraits<typename ValType::value_type> DistTraits;
+	typedef typename DistTraits::type DistType; //ƽ, ʱΪȷֵ
 
 	NodeType* root = nullptr;
 
 	KdTree() = default;
-	KdTree(const KdTree&) = default;
-	KdTree(KdTree&&) = default;
+	//ڵΪָ, ֹǳ, ʱظͷ
+	KdTree(const KdTree&) = delete;
+	KdTree& operator=(const KdTree&) = delete;
+	KdTree(KdTree&& rhs) noexcept
+		:root(rhs.root), TreeHeight(rhs.TreeHeight), build_quality(rhs.build_quality),
+		bound_min(rhs.bound_min), bound_max(rhs.bound_max), node_pool(std::move(rhs.node_pool)), hint_cells(std::move(rhs.hint_cells))
+	{
+		rhs.root = nullptr;
+		rhs.TreeHeight = 0;
+		rhs.node_pool.clear();
+		rhs.hint_cells.clear();
+	}
+	KdTree& operator=(KdTree&& rhs) noexcept
+	{
+		std::swap(root, rhs.root);
+		std::swap(TreeHeight, rhs.TreeHeight);
+		std::swap(build_quality, rhs.build_quality);
+		node_pool.swap(rhs.node_pool);
+		std::swap(bound_min, rhs.bound_min);
+		std::swap(bound_max, rhs.bound_max);
+		hint_cells.swap(rhs.hint_cells);
+		return *this;
+	}
 
-	KdTree(const typename ValType::data_type data[], int size)
+	KdTree(const typename ValType::data_type data[], int size, NodeLayout layout = NodeLayout::Heap,
+		BuildMethod method = BuildMethod::Median)
 	{
 		std::vector<ValType> data_ref;
 		for (int i = 0; i < size; ++i)
@@ -124,30 +443,595 @@ struct KdTree
 			data_ref.emplace_back(data, i);
 		}
 
-		root = BuildKdTree(data_ref.data(), size);
+		Build(data_ref, layout, method);
+	}
+	//ֻ data  indices ָĵ㽨, ڵе ind Ϊ data е±
+	KdTree(const typename ValType::data_type data[], const int indices[], int size, NodeLayout layout = NodeLayout::Heap,
+		BuildMethod method = BuildMethod::Median)
+	{
+		std::vector<ValType> data_ref;
+		for (int i = 0; i < size; ++i)
+		{
+			data_ref.emplace_back(data, indices[i]);
+		}
+
+		Build(data_ref, layout, method);
 	}
 	~KdTree()
 	{
-		ReleaseKdTree(root);
+		if (node_pool.empty())
+			ReleaseKdTree(root);
 	}
 
-	std::pair<NodeType*, double> Query(const typename ValType::data_type& item)
+	//ѽڵŲڴ(Heap Ϊ new Ľڵ), ṹ
+	void Relayout(NodeLayout layout)
 	{
-		return QueryNearestNode(root, item, std::numeric_limits<double>::max());
+		if (!root)
+			return;
+
+		std::vector<NodeType*> order;
+		order.reserve(CountNodes(root));
+		switch (layout)
+		{
+		case NodeLayout::Heap:
+		case NodeLayout::DepthFirst:
+			DepthFirstOrder(root, order);
+			break;
+		case NodeLayout::BreadthFirst:
+			BreadthFirstOrder(root, std::numeric_limits<int>::max(), order);
+			break;
+		case NodeLayout::VanEmdeBoas:
+			VanEmdeBoasOrder(root, TreeHeight, order);
+			break;
+		case NodeLayout::Blocked:
+			{
+				//ÿȡڵܴС LayoutBlockBytes ȫ, Ӵ;
+				//ڵֻ NodeType , ڵСһҲҳС, Կܿҳ
+				int block_levels = 1;
+				while ((size_t(2) << block_levels) - 1 <= LayoutBlockBytes / sizeof(NodeType))
+					++block_levels;
+				BlockedOrder(root, block_levels, order);
+			}
+			break;
+		}
+
+		std::vector<NodeType> new_pool;
+		std::vector<NodeType*> fresh(order.size());
+		if (layout == NodeLayout::Heap)
+		{
+			for (size_t i = 0; i < order.size(); ++i)
+				fresh[i] = new NodeType(*order[i]);
+		}
+		else
+		{
+			new_pool.reserve(order.size());
+			for (size_t i = 0; i < order.size(); ++i)
+			{
+				new_pool.push_back(*order[i]);
+				fresh[i] = &new_pool.back();
+			}
+		}
+
+		//ѱԭ parent, ɽڵ parent ֶݴµַ, ڸдеָ
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i]->parent = fresh[i];
+		for (auto node : fresh)
+		{
+			if (node->parent)
+				node->parent = node->parent->parent;
+			for (auto& child : node->children)
+				if (child)
+					child = child->parent;
+		}
+
+		NodeType* new_root = root->parent;
+		if (node_pool.empty())
+		{
+			for (auto node : order)
+				delete node;
+		}
+		root = new_root;
+		node_pool.swap(new_pool);
 	}
 
-	std::string GenerateMatlabScript(std::array<double, 2> x_range, std::array<double, 2> y_range) const
+	//ʱ±Сĵ
+	//, øΪ data еͬ±(data ԭһ); ½ڵɵ̷߳䲢״д
+	//ŵԭ, ; ֻԭ, ڶ߳ͬʱ
+	KdTree Clone(const typename ValType::data_type data[]) const
+	{
+		KdTree ret;
+		ret.TreeHeight = TreeHeight;
+		ret.build_quality = build_quality;
+		ret.bound_min = bound_min;
+		ret.bound_max = bound_max;
+		ret.hint_cells = hint_cells;
+		if (!root)
+			return ret;
+
+		if (node_pool.empty())
+		{
+			ret.node_pool.reserve(CountNodes(root));
+			ret.root = CloneNode(root, nullptr, data, ret.node_pool);
+			return ret;
+		}
+
+		//¾λͬ, ָ밴ƫƻ
+		ret.node_pool.reserve(node_pool.size());
+		auto rebase = [&](const NodeType* node) { return node ? ret.node_pool.data() + (node - node_pool.data()) : nullptr; };
+		for (const auto& node : node_pool)
+		{
+			ret.node_pool.emplace_back(rebase(node.parent), ValType(data, node.val.GetInd()), node.split_dim,
+				rebase(node.children[0]), rebase(node.children[1]));
+			ret.node_pool.back().summary = node.summary;
+		}
+		ret.root = rebase(root);
+		return ret;
+	}
+
+	std::pair<NodeType*, double> Query(const typename ValType::data_type& item) const
+	{
+		return ToEuclidean(QueryExact(item));
+	}
+
+	//ؾȷƽ; ʱ˳򡢱޹
+	std::pair<NodeType*, DistType> QueryExact(const typename ValType::data_type& item) const
+	{
+		return QueryNearestNode(root, item, DistTraits::Max(), AcceptAll());
+	}
+
+	//ֻ filter ܵĵ, ûĵʱ (nullptr, -1)
+	//filter Ϊ bool(int ind) νʡ± std::vector<bool>,  MakeSummaryFilter ԰ժҪ֦
+	template<typename Filter, typename = typename std::enable_if<!std::is_convertible<Filter, NodeType*>::value>::type>
+	std::pair<NodeType*, double> Query(const typename ValType::data_type& item, const Filter& filter) const
+	{
+		return ToEuclidean(QueryNearestNode(root, item, DistTraits::Max(), filter));
+	}
+
+	//category(ind) صλ( 32 ), ÿڵ¼еλĲ
+	//仯µ; δʱժҪȫΪ 1, κ
+	template<typename Category>
+	void BuildFilterSummary(Category category)
+	{
+		BuildSummaryNode(root, category);
+	}
+
+	//¼ÿڵĵԪ(ȷָΧɵĺ, صΧ), ±,  Query(item, hint) ǰֹͣ
+	//Ԫֻȡ״, Relayout Ч
+	void BuildHintCells()
+	{
+		hint_cells.clear();
+		if (!root)
+			return;
+		int rows = 0;
+		std::vector<NodeType*> order;
+		DepthFirstOrder(root, order);
+		for (auto node : order)
+			rows = std::max(rows, node->val.GetInd() + 1);
+		hint_cells.resize(rows);
+		BuildCellNode(root, bound_min, bound_max);
+	}
+
+	//hint ΪһβѯصĽڵ(Ϊnullptr), ֵ first һβѯ hint
+	//ù BuildHintCells ʱݵһԪϸѯΪֹ,  parent ݵ
+	std::pair<NodeType*, double> Query(const typename ValType::data_type& item, NodeType* hint) const
+	{
+		if (!hint)
+			return Query(item);
+
+		DistType minDist = SquaredEuclideanDistance(item, hint->val);
+
+		NodeType* search_root = hint;
+		if (!hint_cells.empty())
+		{
+			//Ԫ֮ĵ㶼 minDist Ϊ뾶Ĳѯ֮, , Ҳ
+			while (search_root->parent && !CellContains(search_root, item, minDist))
+				search_root = search_root->parent;
+		}
+		else
+		{
+			//ֻȽϷָ, ҵ minDist Ϊ뾶ĲѯԽ()
+			for (NodeType* child = hint, *node = hint->parent; node; child = node, node = node->parent)
+			{
+				bool same_side = (child == node->children[0]) == (item[node->split_dim] < node->val[node->split_dim]);
+				if (!same_side || !(minDist < PlaneDistance(item, node)))
+					search_root = node;
+			}
+		}
+
+		auto ret = QueryNearestNode(search_root, item, minDist, AcceptAll());
+		if (!ret.first || IsCloser(minDist, hint, ret.second, ret.first))
+			return ToEuclidean(std::make_pair(hint, minDist));
+		return ToEuclidean(ret);
+	}
+
+	//first/second  Query ķֵͬ; exact Ϊ false ʾʱ˿ܺ
+	struct BoundedResult
 	{
-		std::string ret = "figure; hold on; axis equal;\n";
-		std::sort(x_range.begin(), x_range.end());
-		std::sort(y_range.begin(), y_range.end());
-		GenerateMatlabScript_recu(root, x_range, y_range, ret);
-		ret += "hold off;\n";
+		NodeType* first;
+		double second;
+		bool exact;
+	};
+
+	//ʱڲѯ: ½Ҷõƽ, ֮Ļʱþʱֹͣ
+	BoundedResult QueryWithin(const typename ValType::data_type& item, QueryDeadline& deadline) const
+	{
+		DeadlineScope scope(deadline);
+		auto ret = ToEuclidean(QueryNearestNode(root, item, DistTraits::Max(), AcceptAll(), scope));
+		return BoundedResult{ ret.first, ret.second, !scope.truncated };
+	}
+
+	//ѯ: group_size ѯ״̬ʽƽ, ÿлǰԤȡòѯһҪʵĽڵ,
+	//ʹѯĻȱʧ໥ص
+	std::vector<std::pair<NodeType*, double>> QueryBatch(const typename ValType::data_type items[], int size, int group_size = 16) const
+	{
+		std::vector<std::pair<NodeType*, double>> ret(size, std::make_pair(nullptr, -1.0));
+		RunBatch(items, size, group_size, NoDeadline(), [&ret](const BatchState& state, const NoDeadline&)
+		{
+			ret[state.item] = ToEuclidean(std::make_pair(state.nearest, state.best));
+		});
+		return ret;
+	}
+
+	//һʱ; ʱþѯԸ½Ҷ, ؽƽ
+	std::vector<BoundedResult> QueryBatchWithin(const typename ValType::data_type items[], int size, QueryDeadline& deadline, int group_size = 16) const
+	{
+		std::vector<BoundedResult> ret(size, BoundedResult{ nullptr, -1, true });
+		RunBatch(items, size, group_size, DeadlineScope(deadline), [&ret](const BatchState& state, const DeadlineScope& scope)
+		{
+			auto found = ToEuclidean(std::make_pair(state.nearest, state.best));
+			ret[state.item] = BoundedResult{ found.first, found.second, !scope.truncated };
+		});
+		return ret;
+	}
+
+	//(ʱ±) k ڵ, ֻǾС max_dist ĵ
+	std::vector<std::pair<NodeType*, double>> QueryKnn(const typename ValType::data_type& item, int k,
+		double max_dist = std::numeric_limits<double>::max()) const
+	{
+		std::vector<std::pair<DistType, NodeType*>> heap;
+		if (k > 0)
+			QueryKnnNode(root, item, heap, k, RadiusBound{ max_dist * max_dist });
+
+		std::sort_heap(heap.begin(), heap.end(), KnnLess);
+		std::vector<std::pair<NodeType*, double>> ret;
+		for (const auto& node_dist : heap)
+			ret.emplace_back(node_dist.second, std::sqrt(DistTraits::ToDouble(node_dist.first)));
 		return ret;
 	}
 
+	//ؾȷƽ, ֻǱ (bound_dist, bound_node) ĵ: ƽС, ȶ±С
+	//bound_node һ(ֻȽ±), ڶ֮ϲ top-k
+	std::vector<std::pair<NodeType*, DistType>> QueryKnnExact(const typename ValType::data_type& item, int k,
+		const DistType& bound_dist = DistTraits::Max(), const NodeType* bound_node = nullptr) const
+	{
+		std::vector<std::pair<DistType, NodeType*>> heap;
+		if (k > 0)
+			QueryKnnNode(root, item, heap, k, ExactBound{ bound_dist, bound_node });
+
+		std::sort_heap(heap.begin(), heap.end(), KnnLess);
+		std::vector<std::pair<NodeType*, DistType>> ret;
+		for (const auto& node_dist : heap)
+			ret.emplace_back(node_dist.second, node_dist.first);
+		return ret;
+	}
+
+	// k ͼ(), threads <= 0 ʱȡӲ߳
+	//С鴦: ÿǰһĽڼΪʼѡ, ֦޴һʼͺܽ
+	KnnGraph BuildKnnGraph(int k, int threads = 0) const
+	{
+		KnnGraph graph;
+		std::vector<std::vector<NodeType*>> buckets(1);
+		CollectKnnBuckets(root, buckets);
+		if (buckets.back().empty())
+			buckets.pop_back();
+
+		int rows = 0, members = 0;
+		for (const auto& bucket : buckets)
+		{
+			members += (int)bucket.size();
+			for (auto node : bucket)
+				rows = std::max(rows, node->val.GetInd() + 1);
+		}
+		const int row_size = std::max(0, std::min(k, members - 1));
+
+		graph.offsets.assign(rows + 1, 0);
+		for (const auto& bucket : buckets)
+			for (auto node : bucket)
+				graph.offsets[node->val.GetInd() + 1] = row_size;
+		for (int i = 0; i < rows; ++i)
+			graph.offsets[i + 1] += graph.offsets[i];
+		graph.indices.resize(graph.offsets.back());
+		graph.sq_dists.resize(graph.offsets.back());
+		if (row_size == 0)
+			return graph;
+
+		ParallelChunks((int)buckets.size(), 1, threads, [&](int b, int)
+		{
+			std::vector<std::pair<DistType, NodeType*>> heap, seeds; //seeds ΪǰһĽ
+			NodeType* previous = nullptr;
+			for (auto node : buckets[b])
+			{
+				const auto& value = node->val.getData();
+				heap.clear();
+				if (previous)
+				{
+					heap.emplace_back(SquaredEuclideanDistance(value, previous->val), previous);
+					for (const auto& seed : seeds)
+					{
+						if (seed.second != node)
+							heap.emplace_back(SquaredEuclideanDistance(value, seed.second->val), seed.second);
+					}
+					std::sort(heap.begin(), heap.end(), KnnLess);
+					if (heap.size() > (size_t)row_size)
+						heap.resize(row_size);
+					std::make_heap(heap.begin(), heap.end(), KnnLess);
+				}
+				QueryKnnNode(root, value, heap, row_size, RadiusBound{ std::numeric_limits<double>::max() }, node, previous != nullptr);
+
+				std::sort_heap(heap.begin(), heap.end(), KnnLess);
+				size_t offset = graph.offsets[node->val.GetInd()];
+				for (int i = 0; i < row_size; ++i)
+				{
+					graph.indices[offset + i] = heap[i].second->val.GetInd();
+					graph.sq_dists[offset + i] = DistTraits::ToDouble(heap[i].first);
+				}
+				seeds.swap(heap);
+				previous = node;
+			}
+		});
+		return graph;
+	}
+
+	//ƽ̶: ȫƽڵ / ƽڵ, λԼΪ 1
+	double BuildQuality() const
+	{
+		return build_quality;
+	}
+
+	//еİΧ, ʱ min > max
+	std::pair<typename ValType::data_type, typename ValType::data_type> Bounds() const
+	{
+		return std::make_pair(bound_min, bound_max);
+	}
+
+	//ʽ, ڴƴű; ڶάݰ opt.projection ͶӰ
+	void Export(std::ostream& os, ExportOptions opt) const
+	{
+		for (int axis = 0; axis < 2; ++axis)
+		{
+			int& dim = opt.projection[axis];
+			if (dim < 0)
+				dim = std::min(axis, ValType::dimensions - 1);
+			else if (dim >= ValType::dimensions)
+				throw std::out_of_range("projection dimension out of range.");
+
+			auto& range = axis == 0 ? opt.x_range : opt.y_range;
+			std::sort(range.begin(), range.end());
+			if (!std::isfinite(range[0]))
+				range[0] = root ? (double)bound_min[dim] : 0;
+			if (!std::isfinite(range[1]))
+				range[1] = root ? (double)bound_max[dim] : 0;
+		}
+
+		auto flags = os.flags();
+		auto precision = os.precision();
+		os << std::fixed << std::setprecision(6);
+		switch (opt.format)
+		{
+		case ExportFormat::Matlab:
+			os << "figure; hold on; axis equal;\n";
+			break;
+		case ExportFormat::Svg:
+			os << "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"" << opt.x_range[0] << " " << -opt.y_range[1] << " "
+				<< opt.x_range[1] - opt.x_range[0] << " " << opt.y_range[1] - opt.y_range[0] << "\">\n"
+				<< "<g transform=\"scale(1,-1)\" stroke-width=\"" << opt.point_radius / 2 << "\">\n";
+			break;
+		case ExportFormat::Binary:
+			{
+				std::int32_t header[] = { 0x3154444b /* "KDT1" */, ValType::dimensions, opt.projection[0], opt.projection[1] };
+				os.write(reinterpret_cast<const char*>(header), sizeof(header));
+			}
+			break;
+		}
+
+		if (root && opt.max_depth >= 0)
+			ExportNode(os, opt, root, opt.x_range, opt.y_range, 0);
+
+		if (opt.format == ExportFormat::Matlab)
+			os << "hold off;\n";
+		else if (opt.format == ExportFormat::Svg)
+			os << "</g>\n</svg>\n";
+		os.flags(flags);
+		os.precision(precision);
+	}
+
+	void Export(const std::string& path, const ExportOptions& opt) const
+	{
+		std::ofstream os(path, std::ios::binary);
+		if (!os)
+			throw std::runtime_error("cannot open " + path);
+		Export(os, opt);
+	}
+
+	std::string GenerateMatlabScript(std::array<double, 2> x_range, std::array<double, 2> y_range) const
+	{
+		ExportOptions opt;
+		opt.x_range = x_range;
+		opt.y_range = y_range;
+		std::ostringstream ret;
+		Export(ret, opt);
+		return ret.str();
+	}
+
 private:
 	int TreeHeight = 0;
+	double build_quality = 1;
+	typename ValType::data_type bound_min = FilledPoint(std::numeric_limits<typename ValType::value_type>::max());
+	typename ValType::data_type bound_max = FilledPoint(std::numeric_limits<typename ValType::value_type>::lowest());
+
+	static typename ValType::data_type FilledPoint(typename ValType::value_type value)
+	{
+		typename ValType::data_type ret;
+		ret.fill(value);
+		return ret;
+	}
+	std::vector<NodeType> node_pool; //ǿʱнڵڴ, ͷ
+	std::vector<std::pair<typename ValType::data_type, typename ValType::data_type>> hint_cells; // BuildHintCells, Ե±
+
+	constexpr static size_t LayoutBlockBytes = 4096; //Blocked ÿĽڵް
+	constexpr static size_t KnnBucketSize = 32;
+	constexpr static int InlinePathSize = 64;
+
+	static size_t CountNodes(const NodeType* node)
+	{
+		return node ? 1 + CountNodes(node->children[0]) + CountNodes(node->children[1]) : 0;
+	}
+
+	template<typename Category>
+	static std::uint32_t BuildSummaryNode(NodeType* node, Category& category)
+	{
+		if (!node)
+			return 0;
+		node->summary = (std::uint32_t)category(node->val.GetInd())
+			| BuildSummaryNode(node->children[0], category) | BuildSummaryNode(node->children[1], category);
+		return node->summary;
+	}
+
+	void BuildCellNode(const NodeType* node, typename ValType::data_type low, typename ValType::data_type high)
+	{
+		if (!node)
+			return;
+		hint_cells[node->val.GetInd()] = std::make_pair(low, high);
+		auto split = node->val[node->split_dim];
+		auto upper = high;
+		upper[node->split_dim] = split;
+		BuildCellNode(node->children[0], low, upper);
+		low[node->split_dim] = split;
+		BuildCellNode(node->children[1], low, high);
+	}
+
+	//item Ԫľ붼ڲѯ뾶
+	bool CellContains(const NodeType* node, const typename ValType::data_type& item, const DistType& sq_radius) const
+	{
+		const auto& cell = hint_cells[node->val.GetInd()];
+		for (int dim = 0; dim < ValType::dimensions; ++dim)
+		{
+			if (!(cell.first[dim] < item[dim] && item[dim] < cell.second[dim]))
+				return false;
+			DistType low = DistType(), high = DistType();
+			DistTraits::Add(low, item[dim], cell.first[dim]);
+			DistTraits::Add(high, item[dim], cell.second[dim]);
+			if (!(sq_radius < low && sq_radius < high))
+				return false;
+		}
+		return true;
+	}
+
+	template<typename Filter>
+	static bool Accepts(const Filter& filter, const NodeType* node)
+	{
+		return filter(node->val.GetInd());
+	}
+
+	static bool Accepts(const std::vector<bool>& bits, const NodeType* node)
+	{
+		return (size_t)node->val.GetInd() < bits.size() && bits[node->val.GetInd()];
+	}
+
+	//пбܵĵ
+	template<typename Filter>
+	static bool MayMatch(const Filter&, const NodeType* node)
+	{
+		return node != nullptr;
+	}
+
+	template<typename Predicate>
+	static bool MayMatch(const SummaryFilter<Predicate>& filter, const NodeType* node)
+	{
+		return node && (node->summary & filter.mask);
+	}
+
+	//pool Ԥ㹻, ֤ѷڵĵַ
+	static NodeType* CloneNode(const NodeType* node, NodeType* parent, const typename ValType::data_type data[], std::vector<NodeType>& pool)
+	{
+		if (!node)
+			return nullptr;
+		pool.emplace_back(parent, ValType(data, node->val.GetInd()), node->split_dim, nullptr, nullptr);
+		NodeType* copy = &pool.back();
+		copy->summary = node->summary;
+		copy->children[0] = CloneNode(node->children[0], copy, data, pool);
+		copy->children[1] = CloneNode(node->children[1], copy, data, pool);
+		return copy;
+	}
+
+	static void DepthFirstOrder(NodeType* node, std::vector<NodeType*>& order)
+	{
+		if (!node)
+			return;
+		order.push_back(node);
+		DepthFirstOrder(node->children[0], order);
+		DepthFirstOrder(node->children[1], order);
+	}
+
+	// node  levels ڵĽڵ, frontier ռ levels 
+	static void BreadthFirstOrder(NodeType* node, int levels, std::vector<NodeType*>& order, std::vector<NodeType*>* frontier = nullptr)
+	{
+		std::vector<NodeType*> level = { node }, next;
+		for (int depth = 0; depth < levels && !level.empty(); ++depth)
+		{
+			next.clear();
+			for (auto current : level)
+			{
+				order.push_back(current);
+				for (auto child : current->children)
+					if (child)
+						next.push_back(child);
+			}
+			level.swap(next);
+		}
+		if (frontier)
+			frontier->insert(frontier->end(), level.begin(), level.end());
+	}
+
+	//van Emde Boas ˳: ϰ벿ֵ°벿ֱָݹ
+	static void VanEmdeBoasOrder(NodeType* node, int levels, std::vector<NodeType*>& order)
+	{
+		if (!node)
+			return;
+		if (levels <= 1)
+		{
+			order.push_back(node);
+			return;
+		}
+
+		int top = levels / 2;
+		std::vector<NodeType*> frontier;
+		CollectAtDepth(node, top, frontier);
+		VanEmdeBoasOrder(node, top, order);
+		for (auto sub : frontier)
+			VanEmdeBoasOrder(sub, levels - top, order);
+	}
+
+	static void CollectAtDepth(NodeType* node, int depth, std::vector<NodeType*>& out)
+	{
+		if (!node)
+			return;
+		if (depth == 0)
+		{
+			out.push_back(node);
+			return;
+		}
+		CollectAtDepth(node->children[0], depth - 1, out);
+		CollectAtDepth(node->children[1], depth - 1, out);
+	}
+
+	static void BlockedOrder(NodeType* node, int block_levels, std::vector<NodeType*>& order)
+	{
+		std::vector<NodeType*> frontier;
+		BreadthFirstOrder(node, block_levels, order, &frontier);
+		for (auto sub : frontier)
+			BlockedOrder(sub, block_levels, order);
+	}
 
 	int ChooseSplitDim(ValType data[], int size)
 	{
@@ -175,7 +1059,7 @@ private:
 		return split_dim;
 	}
 
-	NodeType* BuildKdTree(typename ValType data[], int size, NodeType* parent = nullptr, int depth = 0)
+	NodeType* BuildKdTree(ValType data[], int size, NodeType* parent = nullptr, int depth = 0)
 	{
 		TreeHeight = std::max(TreeHeight, depth);
 		//ChooseSplitDim򲢷ָ
@@ -204,7 +1088,7 @@ private:
 		}
 	}
 
-	void ReleaseKdTree(NodeType* node = root)
+	void ReleaseKdTree(NodeType* node)
 	{
 		if (node)
 		{
@@ -214,56 +1098,498 @@ private:
 		}
 	}
 
-	std::pair<NodeType*, double> QueryNearestNode(NodeType* tree_root, const typename ValType::data_type& value, double minDistParent) const
+	void Build(std::vector<ValType>& data_ref, NodeLayout layout, BuildMethod method)
+	{
+		for (const auto& item : data_ref)
+		{
+			for (int dim = 0; dim < ValType::dimensions; ++dim)
+			{
+				bound_min[dim] = std::min(bound_min[dim], item[dim]);
+				bound_max[dim] = std::max(bound_max[dim], item[dim]);
+			}
+		}
+
+		if (method == BuildMethod::Morton)
+			root = BuildMortonTree(data_ref.data(), (int)data_ref.size());
+		else
+			root = BuildKdTree(data_ref.data(), (int)data_ref.size());
+		if (layout != NodeLayout::Heap)
+			Relayout(layout);
+
+		double depth_sum = SumDepth(root, 0), balanced_sum = 0;
+		for (size_t i = 2; i <= data_ref.size(); ++i)
+			balanced_sum += std::floor(std::log2((double)i));
+		build_quality = depth_sum > 0 ? balanced_sum / depth_sum : 1;
+	}
+
+	static double SumDepth(const NodeType* node, int depth)
+	{
+		return node ? depth + SumDepth(node->children[0], depth + 1) + SumDepth(node->children[1], depth + 1) : 0;
+	}
+
+	//LBVH ʽ:  Morton 벢, ߲ͬλֱȷָ
+	NodeType* BuildMortonTree(ValType data[], int size)
+	{
+		//double ֻ 53 λЧλ, ϸû, ҵάʱ 2^bits ᳬ uint64_t תΧ
+		const int bits = std::min(53, 64 / ValType::dimensions);
+		if (bits == 0 || size <= 1)
+			return BuildKdTree(data, size);
+
+		std::array<double, ValType::dimensions> scale;
+		for (int dim = 0; dim < ValType::dimensions; ++dim)
+		{
+			double extent = (double)bound_max[dim] - (double)bound_min[dim];
+			scale[dim] = extent > 0 ? (std::ldexp(1.0, bits) - 1) / extent : 0;
+		}
+
+		//ʹ 2^bits, صһ
+		const double max_cell = std::ldexp(1.0, bits) - 1;
+		std::vector<std::pair<std::uint64_t, int>> codes(size);
+		for (int i = 0; i < size; ++i)
+		{
+			std::array<std::uint64_t, ValType::dimensions> cell;
+			for (int dim = 0; dim < ValType::dimensions; ++dim)
+				cell[dim] = (std::uint64_t)std::min(max_cell, ((double)data[i][dim] - (double)bound_min[dim]) * scale[dim]);
+
+			std::uint64_t code = 0;
+			for (int bit = bits - 1; bit >= 0; --bit)
+				for (int dim = 0; dim < ValType::dimensions; ++dim)
+					code = (code << 1) | ((cell[dim] >> bit) & 1);
+			codes[i] = std::make_pair(code, i);
+		}
+		RadixSort(codes, bits * ValType::dimensions);
+
+		std::vector<ValType> sorted;
+		std::vector<std::uint64_t> sorted_codes;
+		sorted.reserve(size);
+		sorted_codes.reserve(size);
+		for (const auto& code : codes)
+		{
+			sorted.push_back(data[code.second]);
+			sorted_codes.push_back(code.first);
+		}
+		return BuildMortonNode(sorted.data(), sorted_codes.data(), size, bits * ValType::dimensions);
+	}
+
+	// 8 λһ˵ĵλȻ, ÿ˸̷ֶ߳ͳֱͼɢ
+	static void RadixSort(std::vector<std::pair<std::uint64_t, int>>& codes, int code_bits)
+	{
+		const size_t size = codes.size();
+		const int threads = size < (1 << 16) ? 1 : std::max(1, (int)std::thread::hardware_concurrency());
+		const size_t chunk = (size + threads - 1) / threads;
+		std::vector<std::pair<std::uint64_t, int>> buffer(size);
+		std::vector<std::array<size_t, 256>> offsets(threads);
+
+		for (int shift = 0; shift < code_bits; shift += 8)
+		{
+			auto histogram = [&](int t)
+			{
+				offsets[t].fill(0);
+				for (size_t i = t * chunk; i < std::min(size, (t + 1) * chunk); ++i)
+					++offsets[t][(codes[i].first >> shift) & 0xff];
+			};
+			auto scatter = [&](int t)
+			{
+				auto offset = offsets[t];
+				for (size_t i = t * chunk; i < std::min(size, (t + 1) * chunk); ++i)
+					buffer[offset[(codes[i].first >> shift) & 0xff]++] = codes[i];
+			};
+
+			RunOnThreads(threads, histogram);
+			//ͬһڰ߳˳, ֤ȶ
+			size_t total = 0;
+			for (int digit = 0; digit < 256; ++digit)
+			{
+				for (int t = 0; t < threads; ++t)
+				{
+					size_t count = offsets[t][digit];
+					offsets[t][digit] = total;
+					total += count;
+				}
+			}
+			RunOnThreads(threads, scatter);
+			codes.swap(buffer);
+		}
+	}
+
+	NodeType* BuildMortonNode(ValType data[], std::uint64_t codes[], int size, int code_bits, NodeType* parent = nullptr, int depth = 0)
+	{
+		TreeHeight = std::max(TreeHeight, depth);
+		if (size <= 0)
+			return nullptr;
+		if (size == 1)
+		{
+			// BuildKdTree һ, ߼Ҷ·Ŀӽڵ, 򰴲ʱ©Ҷ
+			TreeHeight = std::max(TreeHeight, depth + 1);
+			int split = parent ? (parent->split_dim + 1) % ValType::dimensions : 0;
+			auto new_node = new NodeType(parent, data[0], split, nullptr, nullptr);
+			return new_node;
+		}
+
+		//ȫͬ(ظͻ)ʱ˻λ
+		std::uint64_t diff = codes[0] ^ codes[size - 1];
+		if (diff == 0)
+			return BuildKdTree(data, size, parent, depth);
+
+		int bit = 63;
+		while (!((diff >> bit) & 1))
+			--bit;
+		int split = (code_bits - 1 - bit) % ValType::dimensions;
+		int mid = (int)(std::partition_point(codes, codes + size,
+			[bit](std::uint64_t code) { return !((code >> bit) & 1); }) - codes);
+
+		//Ұ벿 split άСĵΪָ, ֤ϸСڡҲ಻Сڷֵָ
+		int pivot = mid;
+		for (int i = mid + 1; i < size; ++i)
+			if (data[i][split] < data[pivot][split])
+				pivot = i;
+		std::rotate(data + mid, data + pivot, data + pivot + 1);
+		std::rotate(codes + mid, codes + pivot, codes + pivot + 1);
+
+		auto new_node = new NodeType(parent, data[mid], split);
+		new_node->children[0] = BuildMortonNode(data, codes, mid, code_bits, new_node, depth + 1);
+		new_node->children[1] = BuildMortonNode(data + mid + 1, codes + mid + 1, size - mid - 1, code_bits, new_node, depth + 1);
+		return new_node;
+	}
+
+	//ƽС sq_radius ĵ
+	struct RadiusBound
+	{
+		double sq_radius;
+
+		bool Accepts(const DistType& dist, const NodeType*) const
+		{
+			return DistTraits::ToDouble(dist) < sq_radius;
+		}
+		bool MayReach(const DistType& plane) const
+		{
+			return DistTraits::ToDouble(plane) <= sq_radius;
+		}
+	};
+
+	// IsCloser  (dist, node) ĵ
+	struct ExactBound
+	{
+		DistType dist;
+		const NodeType* node;
+
+		bool Accepts(const DistType& other, const NodeType* other_node) const
+		{
+			return IsCloser(other, other_node, dist, node);
+		}
+		bool MayReach(const DistType& plane) const
+		{
+			return !(dist < plane);
+		}
+	};
+
+	//heap Ϊ KnnLess , δ k ʱ bound Ϊ֦
+	//exclude ; seeded ʾ heap Ѻʼѡ, ǰȥ
+	template<typename Bound>
+	void QueryKnnNode(NodeType* node, const typename ValType::data_type& value,
+		std::vector<std::pair<DistType, NodeType*>>& heap, size_t k, const Bound& bound,
+		const NodeType* exclude = nullptr, bool seeded = false) const
+	{
+		if (!node)
+			return;
+
+		bool left_side = value[node->split_dim] < node->val[node->split_dim];
+		QueryKnnNode(node->children[left_side ? 0 : 1], value, heap, k, bound, exclude, seeded);
+
+		DistType currentDist = SquaredEuclideanDistance(value, node->val);
+		bool accepted = heap.size() < k ? bound.Accepts(currentDist, node)
+			: KnnLess(std::make_pair(currentDist, node), heap.front());
+		if (accepted && node != exclude &&
+			!(seeded && std::any_of(heap.begin(), heap.end(), [node](const std::pair<DistType, NodeType*>& item) { return item.second == node; })))
+		{
+			if (heap.size() == k)
+			{
+				std::pop_heap(heap.begin(), heap.end(), KnnLess);
+				heap.pop_back();
+			}
+			heap.emplace_back(currentDist, node);
+			std::push_heap(heap.begin(), heap.end(), KnnLess);
+		}
+
+		//ָʱԶ, оȶ±Сĵ
+		DistType planeDist = PlaneDistance(value, node);
+		if (heap.size() < k ? bound.MayReach(planeDist) : !(heap.front().first < planeDist))
+			QueryKnnNode(node->children[left_side ? 1 : 0], value, heap, k, bound, exclude, seeded);
+	}
+
+	static bool KnnLess(const std::pair<DistType, NodeType*>& l, const std::pair<DistType, NodeType*>& r)
+	{
+		return IsCloser(l.first, l.second, r.first, r.second);
+	}
+
+	//ʱ±С, ʹ״ͱ˳޹
+	static bool IsCloser(const DistType& dist, const NodeType* node, const DistType& best, const NodeType* best_node)
+	{
+		if (dist < best)
+			return true;
+		return !best_node || (!(best < dist) && node->val.GetInd() < best_node->val.GetInd());
+	}
+
+	static DistType PlaneDistance(const typename ValType::data_type& value, const NodeType* node)
+	{
+		DistType ret = DistType();
+		DistTraits::Add(ret, value[node->split_dim], node->val[node->split_dim]);
+		return ret;
+	}
+
+	static std::pair<NodeType*, double> ToEuclidean(const std::pair<NodeType*, DistType>& node_dist)
+	{
+		if (!node_dist.first)
+			return std::make_pair(nullptr, -1.0);
+		return std::make_pair(node_dist.first, std::sqrt(DistTraits::ToDouble(node_dist.second)));
+	}
+
+	//зΪ KnnBucketSize ڵ(), ڵ
+	//buckets.back() Ϊδ顢ۻ
+	size_t CollectKnnBuckets(NodeType* node, std::vector<std::vector<NodeType*>>& buckets) const
+	{
+		if (!node)
+			return 0;
+
+		size_t begin = buckets.back().size();
+		buckets.back().push_back(node);
+		size_t left = CollectKnnBuckets(node->children[0], buckets);
+		size_t right = CollectKnnBuckets(node->children[1], buckets);
+		size_t size = 1 + left + right;
+		if (size <= KnnBucketSize)
+			return size;
+
+		//: ۻеӽڵԳ, ڵ㵥
+		auto& pending = buckets.back();
+		std::vector<NodeType*> tail(pending.begin() + begin, pending.end());
+		pending.resize(begin);
+		if (left > 0 && left <= KnnBucketSize)
+			buckets.insert(buckets.end() - 1, std::vector<NodeType*>(tail.begin() + 1, tail.begin() + 1 + left));
+		if (right > 0 && right <= KnnBucketSize)
+			buckets.insert(buckets.end() - 1, std::vector<NodeType*>(tail.end() - right, tail.end()));
+		buckets.insert(buckets.end() - 1, std::vector<NodeType*>(1, node));
+		return size;
+	}
+
+	//ʱ, Ϊ, 벻ʱ޵ͬ
+	struct NoDeadline
+	{
+		void Visit() {}
+		void Start() {}
+		bool Allow()
+		{
+			return true;
+		}
+		void Reset() {}
+	};
+
+	//һβѯԹ QueryDeadline ʹ: ״½Ҷ(Start)֮ǰʱԼ,
+	//֮ÿҪµĽڵ㶼ȼʱ, ܾʱ truncated
+	struct DeadlineScope
+	{
+		QueryDeadline* deadline;
+		bool started = false;
+		bool truncated = false;
+
+		explicit DeadlineScope(QueryDeadline& Deadline)
+			:deadline(&Deadline) {}
+		void Visit()
+		{
+			deadline->Visit();
+		}
+		void Start()
+		{
+			started = true;
+		}
+		bool Allow()
+		{
+			if (!started || !deadline->Expired())
+				return true;
+			truncated = true;
+			return false;
+		}
+		void Reset()
+		{
+			started = truncated = false;
+		}
+	};
+
+	//finish(state, scope) ÿѯʱ
+	template<typename Scope, typename Finish>
+	void RunBatch(const typename ValType::data_type items[], int size, int group_size, const Scope& prototype, Finish finish) const
+	{
+		if (!root || size <= 0)
+			return;
+
+		std::vector<BatchState> group(std::max(1, std::min(group_size, size)));
+		std::vector<Scope> scopes(group.size(), prototype);
+		int next_item = 0, active = 0;
+		for (auto& state : group)
+		{
+			state.Reset(next_item++, root);
+			++active;
+		}
+
+		while (active > 0)
+		{
+			for (size_t i = 0; i < group.size(); ++i)
+			{
+				BatchState& state = group[i];
+				if (state.item < 0)
+					continue;
+				if (StepBatchState(state, items[state.item], scopes[i]))
+					continue;
+
+				finish(state, scopes[i]);
+				scopes[i].Reset();
+				if (next_item < size)
+					state.Reset(next_item++, root);
+				else
+				{
+					state.item = -1;
+					--active;
+				}
+			}
+		}
+	}
+
+	struct BatchState
+	{
+		int item = -1;
+		NodeType* node = nullptr;
+		bool data_ready = false; //node ѵ, ѷԤȡ
+		NodeType* nearest = nullptr;
+		DistType best = DistType(); //ƽ
+		std::vector<std::pair<NodeType*, DistType>> pending; //ݵԶ䵽ָƽ
+
+		void Reset(int Item, NodeType* Root)
+		{
+			item = Item;
+			node = Root;
+			data_ready = false;
+			nearest = nullptr;
+			best = DistTraits::Max();
+			pending.clear();
+		}
+	};
+
+	//ƽһ, ѯʱ false
+	template<typename Scope>
+	bool StepBatchState(BatchState& state, const typename ValType::data_type& value, Scope& scope) const
+	{
+		if (!state.node)
+		{
+			scope.Start();
+			while (!state.pending.empty() && state.best < state.pending.back().second)
+				state.pending.pop_back();
+			if (state.pending.empty() || !scope.Allow())
+				return false;
+			state.node = state.pending.back().first;
+			state.pending.pop_back();
+			PrefetchRead(state.node);
+			return true;
+		}
+
+		NodeType* current = state.node;
+		if (!state.data_ready)
+		{
+			PrefetchRead(&current->val.getData());
+			state.data_ready = true;
+			return true;
+		}
+
+		scope.Visit();
+		DistType currentDist = SquaredEuclideanDistance(value, current->val);
+		if (IsCloser(currentDist, current, state.best, state.nearest))
+		{
+			state.best = currentDist;
+			state.nearest = current;
+		}
+
+		bool left_side = value[current->split_dim] < current->val[current->split_dim];
+		NodeType* near_child = current->children[left_side ? 0 : 1];
+		NodeType* far_child = current->children[left_side ? 1 : 0];
+		DistType planeDist = PlaneDistance(value, current);
+		if (far_child && !(state.best < planeDist))
+			state.pending.emplace_back(far_child, planeDist);
+
+		state.node = near_child && scope.Allow() ? near_child : nullptr;
+		state.data_ready = false;
+		if (state.node)
+			PrefetchRead(state.node);
+		return true;
+	}
+
+	//ƽȽ, ָеһҲҪ, ֤ʱõ±Сĵ
+	//ֻ filter ܵĵ, ½ʱ MayMatch Ϊٵ; scope  DeadlineScope
+	template<typename Filter, typename Scope = NoDeadline>
+	std::pair<NodeType*, DistType> QueryNearestNode(NodeType* tree_root, const typename ValType::data_type& value, DistType minDistParent,
+		const Filter& filter, Scope&& scope = Scope()) const
+	{
+		//ݽڵǰ·֮, ѯ·; ʱջ, Ϊÿڴ
+		NodeType* inline_path[InlinePathSize];
+		std::vector<NodeType*> heap_path;
+		NodeType** path = inline_path;
+		if (TreeHeight + 1 > InlinePathSize)
+		{
+			heap_path.resize(TreeHeight + 1);
+			path = heap_path.data();
+		}
+		return QueryNearestPath(tree_root, value, minDistParent, filter, scope, path);
+	}
+
+	//path Ϊõ·ռ, ǰָԭ״
+	template<typename Filter, typename Scope>
+	std::pair<NodeType*, DistType> QueryNearestPath(NodeType* tree_root, const typename ValType::data_type& value, DistType minDistParent,
+		const Filter& filter, Scope& scope, NodeType** path) const
 	{
-		if (!tree_root)
-			return std::make_pair(nullptr, -1);
+		if (!MayMatch(filter, tree_root))
+			return std::make_pair(nullptr, DistTraits::Max());
 		
-		std::stack<NodeType*> path;
+		int path_size = 0;
 		NodeType* nearest = tree_root;
 		while (nearest)
 		{
-			path.push(nearest);
+			path[path_size++] = nearest;
+			scope.Visit();
 			if (value[nearest->split_dim] < nearest->val[nearest->split_dim])
 				nearest = nearest->children[0];
 			else
 				nearest = nearest->children[1];
+			if (!MayMatch(filter, nearest) || !scope.Allow())
+				nearest = nullptr;
 		}
+		scope.Start();
 
 		//ɸʼҶpath, ʼ
-		nearest = path.top();
-		double minDistNow = EuclideanDistance(value, nearest->val);
+		DistType minDistNow = DistTraits::Max();
 
-		while (!path.empty())
+		while (path_size > 0)
 		{
-			auto current = path.top();
-			path.pop();
+			auto current = path[--path_size];
 
-			double currentDistNow = EuclideanDistance(value, current->val);
-			if (minDistNow >= currentDistNow)
+			if (Accepts(filter, current))
 			{
-				minDistNow = currentDistNow;
-				nearest = current;
+				DistType currentDistNow = SquaredEuclideanDistance(value, current->val);
+				if (IsCloser(currentDistNow, current, minDistNow, nearest))
+				{
+					minDistNow = currentDistNow;
+					nearest = current;
+				}
 			}
 
-			double DistToSplitFace = value[current->split_dim] - current->val[current->split_dim];
-			double CurrentRealMin = std::min(minDistNow, minDistParent);
-			if (CurrentRealMin > std::abs(DistToSplitFace))
+			DistType CurrentRealMin = std::min(minDistNow, minDistParent);
+			if (!(CurrentRealMin < PlaneDistance(value, current)))
 			{
-				std::pair<NodeType*, double> ret;
-				ret.second = -1;
-				if (DistToSplitFace >= 0 && current->children[0] != nullptr)
-				{
-					ret = QueryNearestNode(current->children[0], value, CurrentRealMin);
-				}
-				else if (current->children[1] != nullptr)
+				NodeType* far_child = current->children[value[current->split_dim] < current->val[current->split_dim] ? 1 : 0];
+				if (MayMatch(filter, far_child) && scope.Allow())
 				{
-					ret = QueryNearestNode(current->children[1], value, CurrentRealMin);
-				}
-				if (ret.second >= 0 && minDistNow >= ret.second)
-				{
-					minDistNow = ret.second;
-					nearest = ret.first;
+					auto ret = QueryNearestPath(far_child, value, CurrentRealMin, filter, scope, path + path_size);
+					if (ret.first && IsCloser(ret.second, ret.first, minDistNow, nearest))
+					{
+						minDistNow = ret.second;
+						nearest = ret.first;
+					}
 				}
 			}
 		}
@@ -271,46 +1597,81 @@ private:
 		return std::make_pair(nearest, minDistNow);
 	}
 
-	void GenerateMatlabScript_recu(NodeType* node, std::array<double, 2> x_range, std::array<double, 2> y_range, std::string& StringToAppend, int depth = 0) const
+	void ExportNode(std::ostream& os, const ExportOptions& opt, const NodeType* node,
+		std::array<double, 2> x_range, std::array<double, 2> y_range, int depth) const
 	{
-		static_assert(ValType::dimensions == 2, "only support 2d.");
+		const int px = opt.projection[0], py = opt.projection[1];
+		const double x = node->val[px], y = node->val[py];
+		const bool inside = x >= x_range[0] && x <= x_range[1] && y >= y_range[0] && y <= y_range[1];
+		const double shade = (double)depth / std::max(TreeHeight, 1);
 
-		if (!node)
-			return;
+		//ͶӰƽϵ, ֻзָάͶӰάʱŻС
+		std::array<std::array<double, 2>, 2> child_x = { { x_range, x_range } }, child_y = { { y_range, y_range } };
+		if (node->split_dim == px)
+		{
+			child_x[0][1] = std::min(x_range[1], x);
+			child_x[1][0] = std::max(x_range[0], x);
+		}
+		else if (node->split_dim == py)
+		{
+			child_y[0][1] = std::min(y_range[1], y);
+			child_y[1][0] = std::max(y_range[0], y);
+		}
+		std::array<bool, 2> visit;
+		for (int i = 0; i < 2; ++i)
+			visit[i] = node->children[i] && depth < opt.max_depth &&
+				child_x[i][0] <= child_x[i][1] && child_y[i][0] <= child_y[i][1];
 
-		std::string LineColor = ",'Color',[" + std::to_string((double)depth / TreeHeight) + ", 0.3," + std::to_string(1 - (double)depth / TreeHeight) + "]";
-		//
-		StringToAppend += "scatter(" + std::to_string(node->val[0]) + "," + std::to_string(node->val[1]) + ",'ro');\n";
-		//
-		StringToAppend += "text(" + std::to_string(node->val[0] + 5) + "," + std::to_string(node->val[1]) + ",'" +
-			std::to_string(node->val.GetInd()) + "_" + std::to_string(depth) + 
-			"');\n";
-		//ָ
-		if (node->split_dim == 0)
-		{
-			StringToAppend += "line([" +
-				std::to_string(node->val[0]) + "," +
-				std::to_string(node->val[0]) +
-				"],["+
-				std::to_string(y_range[0]) + "," +
-				std::to_string(y_range[1]) +
-				"]" + LineColor + ");\n";
-			//ݹ
-			GenerateMatlabScript_recu(node->children[0], { x_range[0], node->val[0] }, y_range, StringToAppend, depth + 1);
-			GenerateMatlabScript_recu(node->children[1], { node->val[0], x_range[1] }, y_range, StringToAppend, depth + 1);
-		}
-		else 
-		{
-			StringToAppend += "line([" +
-				std::to_string(x_range[0]) + "," +
-				std::to_string(x_range[1]) +
-				"],[" +
-				std::to_string(node->val[1]) + "," +
-				std::to_string(node->val[1]) +
-				"]" + LineColor + ");\n";
-			//ݹ
-			GenerateMatlabScript_recu(node->children[0], x_range, { y_range[0], node->val[1] }, StringToAppend, depth + 1);
-			GenerateMatlabScript_recu(node->children[1], x_range, { node->val[1], y_range[1] }, StringToAppend, depth + 1);
+		if (opt.format == ExportFormat::Binary)
+		{
+			//¼: , ָά, , , ά
+			std::int32_t ind = node->val.GetInd();
+			std::int8_t split = (std::int8_t)node->split_dim;
+			std::uint8_t flags = (visit[0] ? 1 : 0) | (visit[1] ? 2 : 0);
+			std::uint16_t level = (std::uint16_t)depth;
+			os.write(reinterpret_cast<const char*>(&ind), sizeof(ind));
+			os.write(reinterpret_cast<const char*>(&split), sizeof(split));
+			os.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
+			os.write(reinterpret_cast<const char*>(&level), sizeof(level));
+			for (int dim = 0; dim < ValType::dimensions; ++dim)
+			{
+				double coord = node->val[dim];
+				os.write(reinterpret_cast<const char*>(&coord), sizeof(coord));
+			}
 		}
+		else if (inside)
+		{
+			const bool vertical = node->split_dim == px, horizontal = node->split_dim == py;
+			if (opt.format == ExportFormat::Matlab)
+			{
+				//
+				os << "scatter(" << x << "," << y << ",'ro');\n";
+				//
+				os << "text(" << x + 5 << "," << y << ",'" << node->val.GetInd() << "_" << depth << "');\n";
+				//ָ
+				if (vertical)
+					os << "line([" << x << "," << x << "],[" << y_range[0] << "," << y_range[1] << "]";
+				else if (horizontal)
+					os << "line([" << x_range[0] << "," << x_range[1] << "],[" << y << "," << y << "]";
+				if (vertical || horizontal)
+					os << ",'Color',[" << shade << ", 0.3," << 1 - shade << "]);\n";
+			}
+			else
+			{
+				os << "<circle cx=\"" << x << "\" cy=\"" << y << "\" r=\"" << opt.point_radius << "\" fill=\"red\">"
+					<< "<title>" << node->val.GetInd() << "_" << depth << "</title></circle>\n";
+				if (vertical)
+					os << "<line x1=\"" << x << "\" y1=\"" << y_range[0] << "\" x2=\"" << x << "\" y2=\"" << y_range[1] << "\"";
+				else if (horizontal)
+					os << "<line x1=\"" << x_range[0] << "\" y1=\"" << y << "\" x2=\"" << x_range[1] << "\" y2=\"" << y << "\"";
+				if (vertical || horizontal)
+					os << " stroke=\"rgb(" << (int)(255 * shade) << ",77," << (int)(255 * (1 - shade)) << ")\"/>\n";
+			}
+		}
+
+		//ݹ
+		for (int i = 0; i < 2; ++i)
+			if (visit[i])
+				ExportNode(os, opt, node->children[i], child_x[i], child_y[i], depth + 1);
 	}
 };
\ No newline at end of file
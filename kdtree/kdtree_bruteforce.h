@@ -0,0 +1,497 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+#include "kdtree.h"
+//////////////////////////////////////////////////
+// ,  KdTree::Query ʹͬĲѯӿ
+//    갴άȷд, ѯֿ( GEMM ķֿ鷽ʽ)
+//    ѯ SSE2/AVX ֻС, Сֵڵǰʱÿȡ±
+// 磺
+//    BruteForceIndex<ValType> brute(data, size);
+//    auto ret = brute.Query(item);          // ret.first->val, ret.second
+//=======================
+//    NearestNeighborIndex<ValType> index(data, size, batch_size);
+//    // ݵάСڱ KdTree Զѡ
+//
+
+//˫ SIMD , δ SSE2/AVX ʱ˻Ϊ
+struct DoubleLanes
+{
+#if defined(__AVX__)
+	typedef __m256d type;
+	constexpr static int Width = 4;
+	static type Set(double value) { return _mm256_set1_pd(value); }
+	static type Load(const double* ptr) { return _mm256_loadu_pd(ptr); }
+	static void Store(double* ptr, type value) { _mm256_storeu_pd(ptr, value); }
+	static type Add(type l, type r) { return _mm256_add_pd(l, r); }
+	static type SquaredDiff(type l, type r) { type diff = _mm256_sub_pd(l, r); return _mm256_mul_pd(diff, diff); }
+	static type Min(type l, type r) { return _mm256_min_pd(l, r); }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	typedef __m128d type;
+	constexpr static int Width = 2;
+	static type Set(double value) { return _mm_set1_pd(value); }
+	static type Load(const double* ptr) { return _mm_loadu_pd(ptr); }
+	static void Store(double* ptr, type value) { _mm_storeu_pd(ptr, value); }
+	static type Add(type l, type r) { return _mm_add_pd(l, r); }
+	static type SquaredDiff(type l, type r) { type diff = _mm_sub_pd(l, r); return _mm_mul_pd(diff, diff); }
+	static type Min(type l, type r) { return _mm_min_pd(l, r); }
+#else
+	typedef double type;
+	constexpr static int Width = 1;
+	static type Set(double value) { return value; }
+	static type Load(const double* ptr) { return *ptr; }
+	static void Store(double* ptr, type value) { *ptr = value; }
+	static type Add(type l, type r) { return l + r; }
+	static type SquaredDiff(type l, type r) { return (l - r) * (l - r); }
+	static type Min(type l, type r) { return l < r ? l : r; }
+#endif
+};
+
+//һѯһľ, Row άۼƽ, Finish  SquaredDistanceTraits һµƽ
+//갴 double 
+template<typename ty, typename Enable = void>
+struct BruteForceKernel
+{
+	typedef double coord_type;
+	typedef double dist_type;
+
+	template<int BlockSize>
+	struct Row
+	{
+		double dist[BlockSize];
+
+		void Clear(int len)
+		{
+			std::fill(dist, dist + len, 0.0);
+		}
+		void Accumulate(const coord_type column[], ty value, int len)
+		{
+			const double v = (double)value;
+			for (int p = 0; p < len; ++p)
+			{
+				double diff = column[p] - v;
+				dist[p] += diff * diff;
+			}
+		}
+		const dist_type* Finish(int)
+		{
+			return dist;
+		}
+	};
+};
+
+//32 λ: ľֵ 32 λ, ƽΪ 32x32->64 λ˷,  64 λʱλλ
+//ڲѭֻ 64 λ, ; ȷ,  KdTree  WideUInt<2> λһ
+template<typename ty>
+struct BruteForceKernel<ty, typename std::enable_if<std::is_integral<ty>::value && sizeof(ty) <= 4>::type>
+{
+	typedef std::int64_t coord_type;
+	typedef typename SquaredDistanceTraits<ty>::type dist_type;
+
+	template<int BlockSize>
+	struct Row
+	{
+		std::uint64_t lo[BlockSize], hi[BlockSize];
+		dist_type dist[BlockSize];
+
+		void Clear(int len)
+		{
+			std::fill(lo, lo + len, 0);
+			std::fill(hi, hi + len, 0);
+		}
+		void Accumulate(const coord_type column[], ty value, int len)
+		{
+			const std::int64_t v = value;
+			for (int p = 0; p < len; ++p)
+			{
+				std::int64_t diff = column[p] - v;
+				std::uint64_t abs_diff = (std::uint32_t)(diff < 0 ? -diff : diff);
+				std::uint64_t square = abs_diff * abs_diff;
+				lo[p] += square;
+				hi[p] += lo[p] < square;
+			}
+		}
+		const dist_type* Finish(int len)
+		{
+			for (int p = 0; p < len; ++p)
+			{
+				dist[p].limb[0] = lo[p];
+				dist[p].limb[1] = hi[p];
+			}
+			return dist;
+		}
+	};
+};
+
+//64 λ: ÿƽɴ 128 λ,  WideUInt ۼ
+template<typename ty>
+struct BruteForceKernel<ty, typename std::enable_if<std::is_integral<ty>::value && (sizeof(ty) > 4)>::type>
+{
+	typedef ty coord_type;
+	typedef typename SquaredDistanceTraits<ty>::type dist_type;
+
+	template<int BlockSize>
+	struct Row
+	{
+		dist_type dist[BlockSize];
+
+		void Clear(int len)
+		{
+			std::fill(dist, dist + len, dist_type());
+		}
+		void Accumulate(const coord_type column[], ty value, int len)
+		{
+			for (int p = 0; p < len; ++p)
+				SquaredDistanceTraits<ty>::Add(dist[p], column[p], value);
+		}
+		const dist_type* Finish(int)
+		{
+			return dist;
+		}
+	};
+};
+
+template<typename ValType>
+class BruteForceIndex
+{
+public:
+	typedef KdNode<ValType> NodeType;
+	typedef typename ValType::data_type data_type;
+	typedef std::pair<const NodeType*, double> ResultType;
+	typedef BruteForceKernel<typename ValType::value_type> KernelType;
+	typedef SquaredDistanceTraits<typename ValType::value_type> DistTraits;
+	typedef typename KernelType::dist_type DistType; // KdTree<ValType>::DistType ͬ
+
+	BruteForceIndex() = default;
+	BruteForceIndex(const data_type data[], int size)
+		:count(size), stride(RoundUp(size)), coords((size_t)ValType::dimensions * stride, Padding())
+	{
+		nodes.reserve(size);
+		for (int i = 0; i < size; ++i)
+		{
+			nodes.emplace_back(nullptr, ValType(data, i), 0, nullptr, nullptr);
+			for (int dim = 0; dim < ValType::dimensions; ++dim)
+				coords[(size_t)dim * stride + i] = data[i][dim];
+		}
+	}
+
+	//ʱ±Сĵ
+	ResultType Query(const data_type& item) const
+	{
+		return ToEuclidean(QueryExact(item));
+	}
+
+	//ؾȷƽ
+	std::pair<const NodeType*, DistType> QueryExact(const data_type& item) const
+	{
+		std::pair<const NodeType*, DistType> ret;
+		NearestBlock(&item, 1, &ret, UseLanes());
+		return ret;
+	}
+
+	std::vector<ResultType> QueryBatch(const data_type items[], int size) const
+	{
+		std::vector<ResultType> ret(size);
+		std::pair<const NodeType*, DistType> block[QueryBlockSize];
+		for (int i = 0; i < size; i += QueryBlockSize)
+		{
+			const int len = std::min(QueryBlockSize, size - i);
+			NearestBlock(items + i, len, block, UseLanes());
+			std::transform(block, block + len, ret.begin() + i, ToEuclidean);
+		}
+		return ret;
+	}
+
+	//(ʱ±) k 
+	std::vector<ResultType> QueryKnn(const data_type& item, int k) const
+	{
+		std::vector<std::pair<DistType, int>> heap;
+		if (k <= 0)
+			return std::vector<ResultType>();
+
+		ForEachBlock(&item, 1, [&](int, int begin, const DistType* dist, int len)
+		{
+			for (int p = 0; p < len; ++p)
+			{
+				if ((int)heap.size() < k)
+				{
+					heap.emplace_back(dist[p], begin + p);
+					std::push_heap(heap.begin(), heap.end());
+				}
+				else if (dist[p] < heap.front().first)
+				{
+					std::pop_heap(heap.begin(), heap.end());
+					heap.back() = std::make_pair(dist[p], begin + p);
+					std::push_heap(heap.begin(), heap.end());
+				}
+			}
+		});
+
+		std::sort_heap(heap.begin(), heap.end());
+		std::vector<ResultType> ret;
+		for (const auto& item_dist : heap)
+			ret.emplace_back(&nodes[item_dist.second], std::sqrt(DistTraits::ToDouble(item_dist.first)));
+		return ret;
+	}
+
+	int size() const
+	{
+		return count;
+	}
+
+private:
+	constexpr static int QueryBlockSize = 4;
+	constexpr static int PointBlockSize = 256;
+	typedef typename KernelType::template Row<PointBlockSize> RowType;
+	typedef std::is_same<typename KernelType::coord_type, double> UseLanes;
+	typedef DoubleLanes Lanes;
+
+	int count = 0;
+	int stride = 0; //count ȡ SIMD , Ϊ Padding()
+	std::vector<typename KernelType::coord_type> coords; //coords[dim * stride + i]
+	std::vector<NodeType> nodes;
+
+	static int RoundUp(int size)
+	{
+		return (size + Lanes::Width - 1) / Lanes::Width * Lanes::Width;
+	}
+
+	//겹, ľΪ, ᱻѡ
+	static typename KernelType::coord_type Padding()
+	{
+		typedef std::numeric_limits<typename KernelType::coord_type> limits;
+		return limits::has_infinity ? limits::infinity() : typename KernelType::coord_type();
+	}
+
+	//visit(query, begin, dist, len): dist Ϊòѯ [begin, begin + len) ƽ
+	template<typename Visitor>
+	void ForEachBlock(const data_type items[], int item_count, Visitor&& visit) const
+	{
+		RowType rows[QueryBlockSize];
+		for (int begin = 0; begin < count; begin += PointBlockSize)
+		{
+			const int len = std::min(PointBlockSize, count - begin);
+			for (int q = 0; q < item_count; ++q)
+				rows[q].Clear(len);
+
+			for (int dim = 0; dim < ValType::dimensions; ++dim)
+			{
+				const auto* column = coords.data() + (size_t)dim * stride + begin;
+				for (int q = 0; q < item_count; ++q)
+					rows[q].Accumulate(column, items[q][dim], len);
+			}
+
+			for (int q = 0; q < item_count; ++q)
+				visit(q, begin, rows[q].Finish(len), len);
+		}
+	}
+
+	//: ÿֻѯÿС(޷֧ SIMD min), ڵǰʱÿȡ±
+	//ǰĿͨѸ㹻ĵ, ٷ
+	void NearestBlock(const data_type items[], int item_count, std::pair<const NodeType*, DistType> ret[], std::true_type) const
+	{
+		typename Lanes::type query[QueryBlockSize][ValType::dimensions];
+		double best[QueryBlockSize];
+		int best_ind[QueryBlockSize];
+		for (int q = 0; q < item_count; ++q)
+		{
+			best[q] = DistTraits::Max();
+			best_ind[q] = -1;
+			for (int dim = 0; dim < ValType::dimensions; ++dim)
+				query[q][dim] = Lanes::Set((double)items[q][dim]);
+		}
+
+		for (int begin = 0; begin < count; begin += PointBlockSize)
+		{
+			const int len = RoundUp(std::min(PointBlockSize, count - begin));
+			typename Lanes::type block_min[QueryBlockSize];
+			for (int q = 0; q < item_count; ++q)
+				block_min[q] = Lanes::Set(std::numeric_limits<double>::infinity());
+
+			for (int p = begin; p < begin + len; p += Lanes::Width)
+			{
+				typename Lanes::type column[ValType::dimensions];
+				for (int dim = 0; dim < ValType::dimensions; ++dim)
+					column[dim] = Lanes::Load(coords.data() + (size_t)dim * stride + p);
+				//Ϊ NaN ʱ Min ڶ, Ƚʱ NaN ѡһ
+				for (int q = 0; q < item_count; ++q)
+					block_min[q] = Lanes::Min(LaneDistance(column, query[q]), block_min[q]);
+			}
+
+			for (int q = 0; q < item_count; ++q)
+			{
+				double lanes[Lanes::Width];
+				Lanes::Store(lanes, block_min[q]);
+				if (*std::min_element(lanes, lanes + Lanes::Width) < best[q])
+					RescanBlock(begin, len, query[q], best[q], best_ind[q]);
+			}
+		}
+
+		for (int q = 0; q < item_count; ++q)
+			ret[q] = std::make_pair(best_ind[q] < 0 ? nullptr : &nodes[best_ind[q]], best[q]);
+	}
+
+	typename Lanes::type LaneDistance(const typename Lanes::type column[], const typename Lanes::type query[]) const
+	{
+		typename Lanes::type ret = Lanes::SquaredDiff(column[0], query[0]);
+		for (int dim = 1; dim < ValType::dimensions; ++dim)
+			ret = Lanes::Add(ret, Lanes::SquaredDiff(column[dim], query[dim]));
+		return ret;
+	}
+
+	//±˳Ƚ, ʱ±С
+	void RescanBlock(int begin, int len, const typename Lanes::type query[], double& best, int& best_ind) const
+	{
+		for (int p = begin; p < begin + len; p += Lanes::Width)
+		{
+			typename Lanes::type column[ValType::dimensions];
+			for (int dim = 0; dim < ValType::dimensions; ++dim)
+				column[dim] = Lanes::Load(coords.data() + (size_t)dim * stride + p);
+			double lanes[Lanes::Width];
+			Lanes::Store(lanes, LaneDistance(column, query));
+			for (int i = 0; i < Lanes::Width; ++i)
+			{
+				if (lanes[i] < best)
+				{
+					best = lanes[i];
+					best_ind = p + i;
+				}
+			}
+		}
+	}
+
+	void NearestBlock(const data_type items[], int item_count, std::pair<const NodeType*, DistType> ret[], std::false_type) const
+	{
+		DistType best[QueryBlockSize];
+		int best_ind[QueryBlockSize];
+		std::fill(best, best + item_count, DistTraits::Max());
+		std::fill(best_ind, best_ind + item_count, -1);
+
+		ForEachBlock(items, item_count, [&](int q, int begin, const DistType* dist, int len)
+		{
+			//ʱ±С
+			for (int p = 0; p < len; ++p)
+			{
+				if (dist[p] < best[q])
+				{
+					best[q] = dist[p];
+					best_ind[q] = begin + p;
+				}
+			}
+		});
+
+		for (int q = 0; q < item_count; ++q)
+			ret[q] = std::make_pair(best_ind[q] < 0 ? nullptr : &nodes[best_ind[q]], best[q]);
+	}
+
+	static ResultType ToEuclidean(const std::pair<const NodeType*, DistType>& node_dist)
+	{
+		if (!node_dist.first)
+			return ResultType(nullptr, -1);
+		return ResultType(node_dist.first, std::sqrt(DistTraits::ToDouble(node_dist.second)));
+	}
+};
+
+//std::min Ȱȡ, C++14 ⶨ
+template<typename ValType>
+constexpr int BruteForceIndex<ValType>::QueryBlockSize;
+template<typename ValType>
+constexpr int BruteForceIndex<ValType>::PointBlockSize;
+
+// KdTree Ĵģ, λΪ
+template<typename ValType>
+struct BruteForceCrossover
+{
+	typedef typename ValType::data_type data_type;
+
+	double scan_cost = 4e-10;	//: ÿѯÿÿһά
+	double build_cost = 7e-8;	//: ÿ n*log2(n)
+	double query_cost = 5e-8;	//ѯ: ÿѯÿ log2(n)
+
+	bool PreferBruteForce(int size, int batch) const
+	{
+		if (size <= 1)
+			return true;
+		double n = size, log_n = std::log2(n);
+		double brute = (double)batch * n * ValType::dimensions * scan_cost;
+		double tree = n * log_n * build_cost + (double)batch * log_n * query_cost;
+		return brute <= tree;
+	}
+
+	//ʵ, Եǰ ValType Ч
+	static BruteForceCrossover Calibrate(const data_type data[], int size, const data_type queries[], int query_size)
+	{
+		typedef std::chrono::duration<double> seconds;
+		BruteForceCrossover ret;
+		if (size <= 1 || query_size <= 0)
+			return ret;
+		const double n = size, log_n = std::log2(n);
+
+		auto start = std::chrono::steady_clock::now();
+		KdTree<ValType> tree(data, size);
+		auto built = std::chrono::steady_clock::now();
+		auto tree_ret = tree.QueryBatch(queries, query_size);
+		auto queried = std::chrono::steady_clock::now();
+		BruteForceIndex<ValType> brute(data, size);
+		auto scan_start = std::chrono::steady_clock::now();
+		auto brute_ret = brute.QueryBatch(queries, query_size);
+		auto scanned = std::chrono::steady_clock::now();
+
+		ret.build_cost = seconds(built - start).count() / (n * log_n);
+		ret.query_cost = seconds(queried - built).count() / (query_size * log_n);
+		ret.scan_cost = seconds(scanned - scan_start).count() / (query_size * n * ValType::dimensions);
+		return ret;
+	}
+};
+
+// BruteForceCrossover ڽʱѡ KdTree
+template<typename ValType>
+class NearestNeighborIndex
+{
+public:
+	typedef KdNode<ValType> NodeType;
+	typedef typename ValType::data_type data_type;
+	typedef std::pair<const NodeType*, double> ResultType;
+
+	NearestNeighborIndex(const data_type data[], int size, int expected_batch = 1,
+		const BruteForceCrossover<ValType>& crossover = BruteForceCrossover<ValType>())
+		:use_brute_force(crossover.PreferBruteForce(size, expected_batch))
+	{
+		if (use_brute_force)
+			brute = BruteForceIndex<ValType>(data, size);
+		else
+			tree = KdTree<ValType>(data, size);
+	}
+
+	ResultType Query(const data_type& item) const
+	{
+		return use_brute_force ? brute.Query(item) : ResultType(tree.Query(item));
+	}
+
+	std::vector<ResultType> QueryBatch(const data_type items[], int size) const
+	{
+		if (use_brute_force)
+			return brute.QueryBatch(items, size);
+		auto found = tree.QueryBatch(items, size);
+		return std::vector<ResultType>(found.begin(), found.end());
+	}
+
+	bool UsesBruteForce() const
+	{
+		return use_brute_force;
+	}
+
+private:
+	bool use_brute_force;
+	BruteForceIndex<ValType> brute;
+	KdTree<ValType> tree;
+};
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "kdtree.h"
+//////////////////////////////////////////////////
+// NUMA ֪ KdTree: ÿ NUMA ڵһݵڵĸ
+//    ɰڸýڵ CPU ϵ̸߳, ״д(first-touch)ʹҳڱڴ
+//    ѯɳפĹ߳, ÿ CPU һ̲߳ڸ CPU , ֻڵĸ
+//    ڵ޷ʶʱֻһ, ֱõ÷, ̲߳
+// 磺
+//    NumaKdTree<ValType> index(data, size);
+//    auto ret = index.QueryBatch(items, query_size);
+//=======================
+//    صĽڵĸ, ͬһ GetInd() ͬ
+//    ̳߳ this, 󲻿ɸƻƶ
+//
+
+struct NumaTopology
+{
+	//ڵ߼ CPU , Windows Ϊ  *  + ڱ
+	std::vector<std::vector<int>> node_cpus;
+
+	int NodeCount() const
+	{
+		return (int)node_cpus.size();
+	}
+
+	//ֻе CPU; ʶʧʱذȫӲ̵߳ĵڵ
+	static NumaTopology Detect()
+	{
+		NumaTopology ret;
+#if defined(_WIN32)
+		ULONG highest = 0;
+		if (GetNumaHighestNodeNumber(&highest))
+		{
+			for (ULONG node = 0; node <= highest; ++node)
+			{
+				GROUP_AFFINITY affinity;
+				if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity))
+					continue;
+				std::vector<int> cpus;
+				for (int bit = 0; bit < GroupWidth; ++bit)
+					if ((affinity.Mask >> bit) & 1)
+						cpus.push_back(affinity.Group * GroupWidth + bit);
+				if (!cpus.empty())
+					ret.node_cpus.push_back(std::move(cpus));
+			}
+		}
+#elif defined(__linux__)
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+		std::ifstream online("/sys/devices/system/node/online");
+		std::string list;
+		if (online >> list)
+		{
+			for (int node : ParseCpuList(list))
+			{
+				std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				std::vector<int> cpus;
+				if (file >> list)
+					cpus = ParseCpuList(list);
+				if (restricted)
+					cpus.erase(std::remove_if(cpus.begin(), cpus.end(),
+						[&allowed](int cpu) { return cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed); }), cpus.end());
+				//ֻڴû CPU Ľڵ㲻
+				if (!cpus.empty())
+					ret.node_cpus.push_back(std::move(cpus));
+			}
+		}
+#endif
+		if (ret.node_cpus.empty())
+			return SingleNode();
+		return ret;
+	}
+
+	//ȫӲ̵߳ĵڵ
+	static NumaTopology SingleNode()
+	{
+		NumaTopology ret;
+		ret.node_cpus.emplace_back(std::max(1u, std::thread::hardware_concurrency()));
+		std::iota(ret.node_cpus[0].begin(), ret.node_cpus[0].end(), 0);
+		return ret;
+	}
+
+	//ѵ̰߳󶨵 cpu, ƽֻ̨֧ʧʱ false, ߳ճ
+	static bool PinCurrentThread(int cpu)
+	{
+#if defined(_WIN32)
+		GROUP_AFFINITY affinity = {};
+		affinity.Group = (WORD)(cpu / GroupWidth);
+		affinity.Mask = (KAFFINITY)1 << (cpu % GroupWidth);
+		return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+		if (cpu < 0 || cpu >= CPU_SETSIZE)
+			return false;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		(void)cpu;
+		return false;
+#endif
+	}
+
+	//̵߳ǰڵ CPU, δ֪ʱ -1
+	static int CurrentCpu()
+	{
+#if defined(_WIN32)
+		PROCESSOR_NUMBER number;
+		GetCurrentProcessorNumberEx(&number);
+		return number.Group * GroupWidth + number.Number;
+#elif defined(__linux__)
+		return sched_getcpu();
+#else
+		return -1;
+#endif
+	}
+
+private:
+#if defined(_WIN32)
+	constexpr static int GroupWidth = sizeof(KAFFINITY) * 8;
+#endif
+
+	// "0-3,8,10-11" ʽıб
+	static std::vector<int> ParseCpuList(const std::string& list)
+	{
+		std::vector<int> ret;
+		size_t pos = 0;
+		while (pos < list.size())
+		{
+			size_t end = list.find(',', pos);
+			if (end == std::string::npos)
+				end = list.size();
+			std::string range = list.substr(pos, end - pos);
+			size_t dash = range.find('-');
+			try
+			{
+				int first = std::stoi(range.substr(0, dash));
+				int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+				for (int cpu = first; cpu <= last; ++cpu)
+					ret.push_back(cpu);
+			}
+			catch (const std::exception&)
+			{
+				return std::vector<int>();
+			}
+			pos = end + 1;
+		}
+		return ret;
+	}
+};
+
+template<typename ValType>
+class NumaKdTree
+{
+public:
+	typedef KdTree<ValType> TreeType;
+	typedef typename TreeType::NodeType NodeType;
+	typedef typename ValType::data_type data_type;
+	typedef std::pair<NodeType*, double> ResultType;
+
+	//data ɵ÷; ڵʱԴ, ɺ󼴲 data
+	//Detected û CPU Ľڵ㱻, ȫΪʱڵ㴦
+	NumaKdTree(const data_type data[], int size, NodeLayout layout = NodeLayout::DepthFirst,
+		NumaTopology Detected = NumaTopology::Detect())
+		:topology(std::move(Detected))
+	{
+		auto& node_cpus = topology.node_cpus;
+		node_cpus.erase(std::remove_if(node_cpus.begin(), node_cpus.end(),
+			[](const std::vector<int>& cpus) { return cpus.empty(); }), node_cpus.end());
+		if (node_cpus.empty())
+			topology = NumaTopology::SingleNode();
+
+		for (int node = 0; node < topology.NodeCount(); ++node)
+		{
+			for (int cpu : topology.node_cpus[node])
+			{
+				if (cpu >= (int)cpu_node.size())
+					cpu_node.resize(cpu + 1, 0);
+				cpu_node[cpu] = node;
+			}
+		}
+
+		TreeType source(data, size, layout);
+		if (topology.NodeCount() <= 1)
+		{
+			replicas.emplace_back(new NodeReplica);
+			replicas[0]->tree = std::move(source);
+		}
+		else
+		{
+			replicas.resize(topology.NodeCount());
+			std::vector<std::thread> pool;
+			for (int node = 0; node < topology.NodeCount(); ++node)
+			{
+				pool.emplace_back([this, node, data, size, &source]
+				{
+					NumaTopology::PinCurrentThread(topology.node_cpus[node].front());
+					std::unique_ptr<NodeReplica> replica(new NodeReplica);
+					replica->points.assign(data, data + size);
+					replica->tree = source.Clone(replica->points.data());
+					replicas[node] = std::move(replica);
+				});
+			}
+			for (auto& thread : pool)
+				thread.join();
+		}
+
+		for (int node = 0; node < topology.NodeCount(); ++node)
+		{
+			const auto& cpus = topology.node_cpus[node];
+			for (int rank = 0; rank < (int)cpus.size(); ++rank)
+				workers.emplace_back(&NumaKdTree::WorkerLoop, this, node, rank, cpus[rank]);
+		}
+	}
+
+	NumaKdTree(const NumaKdTree&) = delete;
+	NumaKdTree& operator=(const NumaKdTree&) = delete;
+	~NumaKdTree()
+	{
+		{
+			std::lock_guard<std::mutex> lock(pool_mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	int NodeCount() const
+	{
+		return topology.NodeCount();
+	}
+
+	const NumaTopology& Topology() const
+	{
+		return topology;
+	}
+
+	//ýڵĸ, ڵʱнڵŶӦͬһ
+	const TreeType& Replica(int node) const
+	{
+		return replicas[replicas.size() == 1 ? 0 : node]->tree;
+	}
+
+	//ڵ̵߳ǰڽڵĸϲѯ
+	ResultType Query(const data_type& item) const
+	{
+		return Replica(LocalNode()).Query(item);
+	}
+
+	//ɳפ̷ֿ߳ȡѯ, ֻڵ㸱; threads_per_node > 0 ʱÿڵֻǰ threads_per_node ߳
+	//һֱڵ߳ϲѯ; ߳ͬʱʱִ
+	std::vector<ResultType> QueryBatch(const data_type items[], int size, int threads_per_node = 0) const
+	{
+		if (size <= BatchChunk)
+		{
+			auto found = Replica(LocalNode()).QueryBatch(items, size);
+			return std::vector<ResultType>(found.begin(), found.end());
+		}
+
+		std::vector<ResultType> ret(size, ResultType(nullptr, -1));
+		BatchJob job{ items, size, threads_per_node, ret.data() };
+		std::lock_guard<std::mutex> batch(batch_mutex);
+		{
+			std::lock_guard<std::mutex> lock(pool_mutex);
+			current_job = &job;
+			running = (int)workers.size();
+			++generation;
+		}
+		wake.notify_all();
+
+		std::unique_lock<std::mutex> lock(pool_mutex);
+		done.wait(lock, [this] { return running == 0; });
+		return ret;
+	}
+
+private:
+	constexpr static int BatchChunk = 256;
+
+	struct BatchJob
+	{
+		const data_type* items;
+		int size;
+		int threads_per_node;
+		ResultType* ret;
+		std::atomic<int> next{ 0 };
+
+		BatchJob(const data_type* Items, int Size, int ThreadsPerNode, ResultType* Ret)
+			:items(Items), size(Size), threads_per_node(ThreadsPerNode), ret(Ret) {}
+	};
+
+	struct NodeReplica
+	{
+		std::vector<data_type> points; //ڵʱΪ, ֱõ÷
+		TreeType tree;
+	};
+
+	NumaTopology topology;
+	std::vector<int> cpu_node;
+	std::vector<std::unique_ptr<NodeReplica>> replicas;
+
+	std::vector<std::thread> workers;
+	mutable std::mutex batch_mutex; //л QueryBatch
+	mutable std::mutex pool_mutex;
+	mutable std::condition_variable wake, done;
+	mutable BatchJob* current_job = nullptr;
+	mutable unsigned long long generation = 0;
+	mutable int running = 0;
+	bool stopping = false;
+
+	//ÿ generation ʱ current_job, (򲻲)ݼ running
+	void WorkerLoop(int node, int rank, int cpu)
+	{
+		if (replicas.size() > 1)
+			NumaTopology::PinCurrentThread(cpu);
+		const TreeType& tree = Replica(node);
+		unsigned long long seen = 0;
+		for (;;)
+		{
+			BatchJob* job;
+			{
+				std::unique_lock<std::mutex> lock(pool_mutex);
+				wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+				job = current_job;
+			}
+
+			if (job->threads_per_node <= 0 || rank < job->threads_per_node)
+			{
+				for (int begin = job->next.fetch_add(BatchChunk); begin < job->size; begin = job->next.fetch_add(BatchChunk))
+				{
+					auto found = tree.QueryBatch(job->items + begin, std::min(BatchChunk, job->size - begin));
+					std::copy(found.begin(), found.end(), job->ret + begin);
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(pool_mutex);
+			if (--running == 0)
+				done.notify_all();
+		}
+	}
+
+	int LocalNode() const
+	{
+		int cpu = NumaTopology::CurrentCpu();
+		return cpu >= 0 && cpu < (int)cpu_node.size() ? cpu_node[cpu] : 0;
+	}
+};
+
+//std::min ȡ, C++14 ⶨ
+template<typename ValType>
+constexpr int NumaKdTree<ValType>::BatchChunk;
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include "kdtree_snapshot.h"
+//////////////////////////////////////////////////
+// Ƭ: 㰴ռ(ȡλָ)±ϣָ KdTree
+//    ѯƬΧеѯľ½η, ½粻Сڵǰ k ʱֹͣ, ٺϲ top-k
+//    ÿƬ KdTreeSnapshot , ؽжϲѯ
+// 磺
+//    ShardedKdTree<ValType> index(data, size, 8);
+//    auto ret = index.Query(item);       // ret.first Ϊ ValType, ret.second Ϊ
+//    index.RebuildShard(3);
+//=======================
+//    data ɵ÷, Ч
+//
+
+enum class ShardPartition
+{
+	Spatial,	//άȡλָ, ƬΧлص
+	Hash,		//±ϣ, ƬСȵΧ໥ص
+};
+
+template<typename ValType>
+class ShardedKdTree
+{
+public:
+	typedef typename ValType::data_type data_type;
+	typedef KdTree<ValType> TreeType;
+	typedef typename TreeType::NodeType NodeType;
+	typedef typename TreeType::DistType DistType;
+	//ڵָ, Ƭؽ
+	typedef std::pair<ValType, double> ResultType;
+
+	ShardedKdTree(const data_type Data[], int size, int shard_count, ShardPartition partition = ShardPartition::Spatial)
+		:data(Data)
+	{
+		shard_count = std::max(1, shard_count);
+		std::vector<std::vector<int>> members(shard_count);
+		if (partition == ShardPartition::Spatial)
+		{
+			std::vector<int> all(size);
+			std::iota(all.begin(), all.end(), 0);
+			SplitSpatial(all.data(), size, members.data(), shard_count);
+		}
+		else
+		{
+			for (int i = 0; i < size; ++i)
+				members[(unsigned)i * 2654435761u % (unsigned)shard_count].push_back(i);
+		}
+
+		for (int i = 0; i < shard_count; ++i)
+			shards.emplace_back(new Shard);
+
+		//Ƭн
+		std::vector<std::thread> builders;
+		for (int i = 0; i < shard_count; ++i)
+			builders.emplace_back([this, i, &members] { RebuildShard(i, std::move(members[i])); });
+		for (auto& builder : builders)
+			builder.join();
+	}
+
+	int ShardCount() const
+	{
+		return (int)shards.size();
+	}
+
+	//ԭ±꼯¶ȡ겢ؽ÷Ƭ
+	void RebuildShard(int shard)
+	{
+		Shard& target = *shards.at(shard);
+		std::lock_guard<std::mutex> lock(target.mutex);
+		target.tree.Publish(TreeType(data, target.indices.data(), (int)target.indices.size()));
+	}
+
+	//µ±꼯ؽ÷Ƭ
+	void RebuildShard(int shard, std::vector<int> indices)
+	{
+		Shard& target = *shards.at(shard);
+		std::lock_guard<std::mutex> lock(target.mutex);
+		target.indices = std::move(indices);
+		target.tree.Publish(TreeType(data, target.indices.data(), (int)target.indices.size()));
+	}
+
+	ResultType Query(const data_type& item) const
+	{
+		auto ret = QueryKnn(item, 1);
+		return ret.empty() ? ResultType(ValType(data, -1), -1) : ret.front();
+	}
+
+	//(ʱ±) k , Ƭʽ޹
+	std::vector<ResultType> QueryKnn(const data_type& item, int k) const
+	{
+		std::vector<ResultType> ret;
+		if (k <= 0)
+			return ret;
+
+		//ȡȫƬĿ, ֤һβѯڰΧһ
+		std::vector<typename KdTreeSnapshot<ValType>::Reader> readers;
+		std::vector<std::pair<DistType, int>> order;
+		readers.reserve(shards.size());
+		for (size_t i = 0; i < shards.size(); ++i)
+		{
+			readers.push_back(shards[i]->tree.Acquire());
+			if (readers.back())
+				order.emplace_back(SquaredBoxDistance(item, readers.back()->Bounds()), (int)i);
+		}
+		std::sort(order.begin(), order.end());
+
+		//Ծȷƽϲ, ڵ readers ͷǰЧ
+		std::vector<std::pair<NodeType*, DistType>> merged;
+		auto closer = [](const std::pair<NodeType*, DistType>& l, const std::pair<NodeType*, DistType>& r)
+		{
+			return l.second < r.second || (!(r.second < l.second) && l.first->val.GetInd() < r.first->val.GetInd());
+		};
+		for (const auto& shard_dist : order)
+		{
+			std::vector<std::pair<NodeType*, DistType>> found;
+			if ((int)merged.size() == k)
+			{
+				//Χ½ڵ k ʱ, ƬԿоȶ±Сĵ
+				if (merged.back().second < shard_dist.first)
+					break;
+				found = readers[shard_dist.second]->QueryKnnExact(item, k, merged.back().second, merged.back().first);
+			}
+			else
+				found = readers[shard_dist.second]->QueryKnnExact(item, k);
+
+			size_t middle = merged.size();
+			merged.insert(merged.end(), found.begin(), found.end());
+			std::inplace_merge(merged.begin(), merged.begin() + middle, merged.end(), closer);
+			if ((int)merged.size() > k)
+				merged.erase(merged.begin() + k, merged.end());
+		}
+
+		for (const auto& node_dist : merged)
+			ret.emplace_back(node_dist.first->val, std::sqrt(TreeType::DistTraits::ToDouble(node_dist.second)));
+		return ret;
+	}
+
+	//ѯֿ threads ̲߳д, threads <= 0 ʱȡӲ߳
+	std::vector<ResultType> QueryBatch(const data_type items[], int size, int threads = 0) const
+	{
+		std::vector<ResultType> ret(size, ResultType(ValType(data, -1), -1));
+		ParallelChunks(size, 256, threads, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; ++i)
+				ret[i] = Query(items[i]);
+		});
+		return ret;
+	}
+
+private:
+	struct Shard
+	{
+		std::mutex mutex; //лͬһƬؽ
+		std::vector<int> indices;
+		KdTreeSnapshot<ValType> tree;
+	};
+
+	const data_type* data;
+	std::vector<std::unique_ptr<Shard>> shards;
+
+	//ѯ㵽Χľȷƽ
+	static DistType SquaredBoxDistance(const data_type& item, const std::pair<data_type, data_type>& box)
+	{
+		data_type nearest;
+		for (int dim = 0; dim < ValType::dimensions; ++dim)
+			nearest[dim] = std::min(std::max(item[dim], box.first[dim]), box.second[dim]);
+		return SquaredEuclideanDistance(item, nearest);
+	}
+
+	void SplitSpatial(int indices[], int size, std::vector<int> out[], int count) const
+	{
+		if (count == 1 || size == 0)
+		{
+			out[0].assign(indices, indices + size);
+			return;
+		}
+
+		//ʹ÷Ϊ
+		std::array<double, ValType::dimensions> split_judge;
+		for (int dim = 0; dim < ValType::dimensions; ++dim)
+		{
+			double tmp1 = 0, tmp2 = 0;
+			for (int i = 0; i < size; ++i)
+			{
+				double value = data[indices[i]][dim];
+				tmp1 += value * value / size;
+				tmp2 += value / size;
+			}
+			split_judge[dim] = tmp1 - tmp2 * tmp2;
+		}
+		int split_dim = (int)(std::max_element(split_judge.begin(), split_judge.end()) - split_judge.begin());
+
+		//Ƭз, ֵ count / 2 Ƭ
+		int left_count = count / 2;
+		int mid = (int)((long long)size * left_count / count);
+		std::nth_element(indices, indices + mid, indices + size,
+			[this, split_dim](int l, int r) { return data[l][split_dim] < data[r][split_dim]; });
+		SplitSpatial(indices, mid, out, left_count);
+		SplitSpatial(indices + mid, size - mid, out + left_count, count - left_count);
+	}
+};
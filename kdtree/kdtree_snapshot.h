@@ -0,0 +1,317 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "kdtree.h"
+//////////////////////////////////////////////////
+// ڲѯڼ滻 KdTree 汾
+//    ͨ Acquire() ȡÿ, ѯ·ϲ(ռһ hazard )
+//    д⽨,  Publish()/Rebuild() ԭӷ°汾
+//    ɰ汾ڷʱ޶߼дͷ, һ̨֪ͨ߳ͷ, ߳ϲͷ
+// 磺
+//    KdTreeSnapshot<ValType> index;
+//    index.Rebuild(points);            // ̨ؽ߳
+//    auto snap = index.Acquire();      // ѯ߳
+//    if (snap) snap->Query(item);
+//=======================
+//    ն󲻿ɿԽ KdTreeSnapshot 
+//    hazard ۰ BlockSlots һ, ͬʱпյĶ߸ʱ׷¿, ۿǰͷ
+//
+
+template<typename ValType, int BlockSlots = 128>
+class KdTreeSnapshot
+{
+public:
+	typedef KdTree<ValType> TreeType;
+	typedef typename ValType::data_type data_type;
+
+private:
+	struct Version
+	{
+		std::vector<data_type> points; //Rebuildʱ, 汾е
+		TreeType tree;
+		unsigned long long epoch = 0;
+	};
+	typedef std::atomic<Version*> SlotType;
+	struct SlotBlock
+	{
+		std::array<SlotType, BlockSlots> slots;
+		std::atomic<SlotBlock*> next{ nullptr };
+
+		SlotBlock()
+		{
+			for (auto& slot : slots)
+				slot.store(nullptr, std::memory_order_relaxed);
+		}
+	};
+
+public:
+	class Reader
+	{
+	public:
+		Reader(Reader&& rhs) noexcept
+			:owner(rhs.owner), slot(rhs.slot), version(rhs.version)
+		{
+			rhs.slot = nullptr;
+			rhs.version = nullptr;
+		}
+		Reader& operator=(Reader&& rhs) noexcept
+		{
+			if (this != &rhs)
+			{
+				Release();
+				owner = rhs.owner;
+				slot = rhs.slot;
+				version = rhs.version;
+				rhs.slot = nullptr;
+				rhs.version = nullptr;
+			}
+			return *this;
+		}
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+		~Reader()
+		{
+			Release();
+		}
+
+		const TreeType& operator*() const
+		{
+			return version->tree;
+		}
+		const TreeType* operator->() const
+		{
+			return &version->tree;
+		}
+		explicit operator bool() const
+		{
+			return version != nullptr;
+		}
+		unsigned long long Epoch() const
+		{
+			return version ? version->epoch : 0;
+		}
+		void Release()
+		{
+			if (slot)
+			{
+				slot->store(nullptr);
+				//ѱ滻İ汾ֻδͷ, ֻ֪ͨ߳
+				if (owner->current.load() != version)
+					owner->RequestReclaim();
+			}
+			slot = nullptr;
+			version = nullptr;
+		}
+
+	private:
+		friend class KdTreeSnapshot;
+		Reader(const KdTreeSnapshot* Owner, SlotType* Slot, Version* Ver)
+			:owner(Owner), slot(Slot), version(Ver) {}
+
+		const KdTreeSnapshot* owner;
+		SlotType* slot;
+		Version* version;
+	};
+
+	KdTreeSnapshot() = default;
+	KdTreeSnapshot(const KdTreeSnapshot&) = delete;
+	KdTreeSnapshot& operator=(const KdTreeSnapshot&) = delete;
+	~KdTreeSnapshot()
+	{
+		{
+			std::lock_guard<std::mutex> lock(reclaim_mutex);
+			reclaim_stopping = true;
+		}
+		reclaim_wake.notify_one();
+		if (reclaimer.joinable())
+			reclaimer.join();
+
+		delete current.load();
+		for (auto ver : retired)
+			delete ver;
+		for (SlotBlock* block = hazards.next.load(); block;)
+		{
+			SlotBlock* next = block->next.load();
+			delete block;
+			block = next;
+		}
+	}
+
+	Reader Acquire() const
+	{
+		Version* ver = current.load();
+		if (!ver)
+			return Reader(this, nullptr, nullptr);
+
+		SlotType& slot = ClaimSlot(ver);
+		//ǼǺٴȷϸð汾ǵǰ汾, շɨ
+		Version* now = current.load();
+		while (now != ver)
+		{
+			if (!now)
+			{
+				slot.store(nullptr);
+				return Reader(this, nullptr, nullptr);
+			}
+			ver = now;
+			slot.store(ver);
+			now = current.load();
+		}
+		return Reader(this, &slot, ver);
+	}
+
+	//tree õĵɵ÷֤ڸð汾ǰЧ
+	unsigned long long Publish(TreeType tree)
+	{
+		std::unique_ptr<Version> ver(new Version);
+		ver->tree = std::move(tree);
+		return Install(std::move(ver));
+	}
+
+	//ڵ߳Ͻ(κ), ú󷢲
+	unsigned long long Rebuild(std::vector<data_type> points)
+	{
+		std::unique_ptr<Version> ver(new Version);
+		ver->points = std::move(points);
+		ver->tree = TreeType(ver->points.data(), (int)ver->points.size());
+		return Install(std::move(ver));
+	}
+
+	//ͷ޶õľɰ汾, Դյİ汾
+	size_t Reclaim()
+	{
+		std::vector<Version*> unused;
+		size_t pending;
+		{
+			std::lock_guard<std::mutex> lock(writer_mutex);
+			unused = TakeUnused();
+			pending = retired.size();
+		}
+		for (auto ver : unused)
+			delete ver;
+		return pending;
+	}
+
+	//ѱ滻δͷŵİ汾; һͷźɻ߳첽ͷ, ڼԼ
+	size_t RetiredCount()
+	{
+		std::lock_guard<std::mutex> lock(writer_mutex);
+		return retired.size();
+	}
+
+	unsigned long long Epoch() const
+	{
+		Version* ver = current.load();
+		return ver ? ver->epoch : 0;
+	}
+
+private:
+	std::atomic<Version*> current{ nullptr };
+	mutable SlotBlock hazards;
+
+	std::mutex writer_mutex; //߲
+	mutable std::mutex reclaim_mutex;
+	mutable std::condition_variable reclaim_wake;
+	mutable bool reclaim_requested = false;
+	bool reclaim_stopping = false;
+	std::thread reclaimer; //״оɰ汾δͷŶʱ
+	std::vector<Version*> retired;
+	unsigned long long epoch_counter = 0;
+
+	//ڲۿһղ۵Ǽ ver, ȫռʱ׷¿, ȴ
+	SlotType& ClaimSlot(Version* ver) const
+	{
+		size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+		for (SlotBlock* block = &hazards;;)
+		{
+			for (int i = 0; i < BlockSlots; ++i)
+			{
+				SlotType& slot = block->slots[(start + i) % BlockSlots];
+				Version* expected = nullptr;
+				if (slot.load(std::memory_order_relaxed) == nullptr && slot.compare_exchange_strong(expected, ver))
+					return slot;
+			}
+
+			SlotBlock* next = block->next.load();
+			if (!next)
+			{
+				std::unique_ptr<SlotBlock> fresh(new SlotBlock);
+				if (block->next.compare_exchange_strong(next, fresh.get()))
+					next = fresh.release();
+			}
+			block = next;
+		}
+	}
+
+	unsigned long long Install(std::unique_ptr<Version> ver)
+	{
+		unsigned long long epoch;
+		std::vector<Version*> unused;
+		{
+			std::lock_guard<std::mutex> lock(writer_mutex);
+			epoch = ver->epoch = ++epoch_counter;
+			Version* old = current.exchange(ver.release());
+			if (old)
+				retired.push_back(old);
+			unused = TakeUnused();
+			if (!retired.empty() && !reclaimer.joinable())
+				reclaimer = std::thread(&KdTreeSnapshot::ReclaimLoop, this);
+		}
+		for (auto old : unused)
+			delete old;
+		return epoch;
+	}
+
+	//ߵ: ֻñǲѻ߳
+	void RequestReclaim() const
+	{
+		{
+			std::lock_guard<std::mutex> lock(reclaim_mutex);
+			reclaim_requested = true;
+		}
+		reclaim_wake.notify_one();
+	}
+
+	void ReclaimLoop()
+	{
+		std::unique_lock<std::mutex> lock(reclaim_mutex);
+		for (;;)
+		{
+			reclaim_wake.wait(lock, [this] { return reclaim_stopping || reclaim_requested; });
+			if (reclaim_stopping)
+				return;
+			reclaim_requested = false;
+			lock.unlock();
+			Reclaim();
+			lock.lock();
+		}
+	}
+
+	//ȡ޶õľɰ汾,  writer_mutex; ͷ
+	std::vector<Version*> TakeUnused()
+	{
+		std::vector<Version*> in_use;
+		for (const SlotBlock* block = &hazards; block; block = block->next.load())
+		{
+			for (auto& slot : block->slots)
+			{
+				Version* ver = slot.load();
+				if (ver)
+					in_use.push_back(ver);
+			}
+		}
+		std::sort(in_use.begin(), in_use.end());
+
+		auto busy = std::partition(retired.begin(), retired.end(),
+			[&in_use](Version* ver) { return std::binary_search(in_use.begin(), in_use.end(), ver); });
+		std::vector<Version*> ret(busy, retired.end());
+		retired.erase(busy, retired.end());
+		return ret;
+	}
+};
@@ -1,7 +1,14 @@
 #include <ctime>
+#include <cstdio>
+#include <cstring>
 #include <vector>
 #include "time_utility.h"
 #include "kdtree.h"
+#include "kdtree_bruteforce.h"
+#include "kdtree_numa.h"
+#include "kdtree_shard.h"
+#include "kdtree_snapshot.h"
+#include "kdtree_vptree.h"
 
 #define FLANN_USE_CUDA
 #include <flann/flann.hpp>
@@ -56,10 +63,568 @@ std::vector<ValType> mine_check(const std::vector<ValMemType>& test_data, const
 	}
 	timer.EndTimer("TIME FOR KDTREE QUERYING: ");
 
+	timer.StartTimer();
+	auto batch = root.QueryBatch(query_data.data(), query_data.size());
+	timer.EndTimer("TIME FOR KDTREE BATCH QUERYING: ");
+	for (int i = 0; i < query_data.size(); ++i)
+	{
+		if (std::abs(batch[i].second - EuclideanDistance(ret[i], query_data[i])) > 1e-6)
+			std::cout << i + 1 << "-th batch query didn't match." << std::endl;
+	}
+
+	//ڲѯĹ켣, һνΪ hint; ԶСڵʱ hint 
+	std::vector<ValMemType> stream(query_data.size());
+	for (int i = 0; i < stream.size(); ++i)
+	{
+		for (int dim = 0; dim < nn; ++dim)
+		{
+			double step = (rand() % 201 - 100) / 400.0;
+			stream[i][dim] = i == 0 ? query_data[0][dim] : std::min<double>(mod_n, std::max(0.0, stream[i - 1][dim] + step));
+		}
+	}
+	timer.StartTimer();
+	std::vector<std::pair<KdTree<ValType>::NodeType*, double>> stream_ret;
+	for (int i = 0; i < stream.size(); ++i)
+		stream_ret.push_back(root.Query(stream[i]));
+	timer.EndTimer("TIME FOR KDTREE STREAM QUERYING: ");
+
+	// parent ݵ, Ԫݵһѯȼֹͣ
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		if (pass == 1)
+		{
+			timer.StartTimer();
+			root.BuildHintCells();
+			timer.EndTimer("TIME FOR KDTREE HINT CELLS BUILDING: ");
+		}
+
+		timer.StartTimer();
+		KdTree<ValType>::NodeType* hint = nullptr;
+		std::vector<std::pair<KdTree<ValType>::NodeType*, double>> hinted;
+		for (int i = 0; i < stream.size(); ++i)
+		{
+			hinted.push_back(root.Query(stream[i], hint));
+			hint = hinted.back().first;
+		}
+		timer.EndTimer(pass == 0 ? "TIME FOR KDTREE STREAM QUERYING (HINT, NO CELLS): " : "TIME FOR KDTREE STREAM QUERYING (HINT): ");
+		for (int i = 0; i < stream.size(); ++i)
+		{
+			if (hinted[i].first != stream_ret[i].first || hinted[i].second != stream_ret[i].second)
+				std::cout << i + 1 << "-th hinted query didn't match." << std::endl;
+		}
+	}
+
 	return ret;
 }
 
 
+void layout_check(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
+{
+	const std::pair<NodeLayout, std::string> layouts[] = {
+		{ NodeLayout::Heap, "HEAP" },
+		{ NodeLayout::DepthFirst, "DEPTH FIRST" },
+		{ NodeLayout::BreadthFirst, "BREADTH FIRST" },
+		{ NodeLayout::VanEmdeBoas, "VAN EMDE BOAS" },
+		{ NodeLayout::Blocked, "BLOCKED" },
+	};
+
+	double reference = -1;
+	for (const auto& layout : layouts)
+	{
+		Timer<> timer;
+		KdTree<ValType> root(test_data.data(), test_data.size(), layout.first);
+		timer.EndTimer("TIME FOR KDTREE BUILDING (" + layout.second + "): ");
+
+		timer.StartTimer();
+		double total = 0;
+		for (int i = 0; i < query_data.size(); ++i)
+			total += root.Query(query_data[i]).second;
+		timer.EndTimer("TIME FOR KDTREE QUERYING (" + layout.second + "): ");
+
+		if (reference < 0)
+			reference = total;
+		else if (std::abs(total - reference) > 1e-6 * query_data.size())
+			std::cout << layout.second << " layout didn't match." << std::endl;
+	}
+}
+
+
+void builder_check(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
+{
+	const std::pair<BuildMethod, std::string> methods[] = {
+		{ BuildMethod::Median, "MEDIAN" },
+		{ BuildMethod::Morton, "MORTON" },
+	};
+
+	double reference = -1;
+	for (const auto& method : methods)
+	{
+		Timer<> timer;
+		KdTree<ValType> root(test_data.data(), test_data.size(), NodeLayout::Heap, method.first);
+		timer.EndTimer("TIME FOR KDTREE BUILDING (" + method.second + "): ");
+		std::cout << "BUILD QUALITY (" << method.second << "): " << root.BuildQuality() << std::endl;
+
+		timer.StartTimer();
+		double total = 0;
+		for (int i = 0; i < query_data.size(); ++i)
+			total += root.Query(query_data[i]).second;
+		timer.EndTimer("TIME FOR KDTREE QUERYING (" + method.second + "): ");
+
+		if (reference < 0)
+			reference = total;
+		else if (std::abs(total - reference) > 1e-6 * query_data.size())
+			std::cout << method.second << " builder didn't match." << std::endl;
+	}
+
+	//һάݵ Morton ÿάλ, λ֮
+	using LineValType = DataType<double, 1>;
+	std::vector<LineValType::data_type> line_data, line_query;
+	for (const auto& item : test_data)
+		line_data.push_back({ { item[0] } });
+	for (const auto& item : query_data)
+		line_query.push_back({ { item[0] } });
+	//ʱظ, ĵ㲻ᱻͬĵڸ
+	for (int size : { 4, 20, 100, (int)line_data.size() })
+	{
+		KdTree<LineValType> line_median(line_data.data(), size, NodeLayout::Heap, BuildMethod::Median);
+		KdTree<LineValType> line_morton(line_data.data(), size, NodeLayout::Heap, BuildMethod::Morton);
+		for (int i = 0; i < line_query.size(); ++i)
+		{
+			if (std::abs(line_median.Query(line_query[i]).second - line_morton.Query(line_query[i]).second) > 1e-6)
+				std::cout << i + 1 << "-th 1D query of MORTON builder with " << size << " points didn't match." << std::endl;
+		}
+	}
+}
+
+
+void filter_check(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
+{
+	constexpr int categories = 8, wanted = 3;
+	std::vector<ValMemType> subset;
+	for (int i = wanted; i < test_data.size(); i += categories)
+		subset.push_back(test_data[i]);
+	auto reference = BruteForceIndex<ValType>(subset.data(), subset.size()).QueryBatch(query_data.data(), query_data.size());
+
+	KdTree<ValType> root(test_data.data(), test_data.size());
+	root.BuildFilterSummary([](int ind) { return 1u << (ind % categories); });
+	auto predicate = [](int ind) { return ind % categories == wanted; };
+
+	Timer<> timer;
+	std::vector<double> found;
+	for (int i = 0; i < query_data.size(); ++i)
+		found.push_back(root.Query(query_data[i], predicate).second);
+	timer.EndTimer("TIME FOR KDTREE FILTERED QUERYING (PREDICATE): ");
+
+	timer.StartTimer();
+	auto filter = MakeSummaryFilter(1u << wanted, predicate);
+	std::vector<double> found_summary;
+	for (int i = 0; i < query_data.size(); ++i)
+		found_summary.push_back(root.Query(query_data[i], filter).second);
+	timer.EndTimer("TIME FOR KDTREE FILTERED QUERYING (SUMMARY): ");
+
+	for (int i = 0; i < query_data.size(); ++i)
+	{
+		if (std::abs(found[i] - reference[i].second) > 1e-6 || std::abs(found_summary[i] - reference[i].second) > 1e-6)
+			std::cout << i + 1 << "-th filtered query didn't match." << std::endl;
+	}
+}
+
+
+void vptree_check(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
+{
+	Timer<> timer;
+	VpTree<ValType> root(test_data.data(), test_data.size());
+	timer.EndTimer("TIME FOR VPTREE BUILDING: ");
+
+	timer.StartTimer();
+	auto found = root.QueryBatch(query_data.data(), query_data.size());
+	timer.EndTimer("TIME FOR VPTREE BATCH QUERYING: ");
+
+	KdTree<ValType> reference(test_data.data(), test_data.size());
+	for (int i = 0; i < query_data.size(); ++i)
+	{
+		auto expected = reference.Query(query_data[i]);
+		if (found[i].first->val.GetInd() != expected.first->val.GetInd() || std::abs(found[i].second - expected.second) > 1e-6)
+			std::cout << i + 1 << "-th vptree query didn't match." << std::endl;
+	}
+
+	//: ӳΪγ뾭, ĴԲȽ
+	std::vector<ValMemType> geo_data, geo_query;
+	for (const auto& item : test_data)
+		geo_data.push_back({ { item[0] * 180 / mod_n - 90, item[1] * 360 / mod_n - 180 } });
+	for (const auto& item : query_data)
+		geo_query.push_back({ { item[0] * 180 / mod_n - 90, item[1] * 360 / mod_n - 180 } });
+
+	timer.StartTimer();
+	VpTree<ValType, HaversineMetric> geo(geo_data.data(), geo_data.size());
+	timer.EndTimer("TIME FOR VPTREE BUILDING (HAVERSINE): ");
+	timer.StartTimer();
+	auto geo_found = geo.QueryBatch(geo_query.data(), geo_query.size());
+	timer.EndTimer("TIME FOR VPTREE BATCH QUERYING (HAVERSINE): ");
+
+	HaversineMetric metric;
+	for (int i = 0; i < geo_query.size(); i += 97)
+	{
+		int expected = -1;
+		double expected_dist = std::numeric_limits<double>::max();
+		for (int j = 0; j < geo_data.size(); ++j)
+		{
+			double dist = metric(geo_query[i], geo_data[j]);
+			if (dist < expected_dist)
+			{
+				expected = j;
+				expected_dist = dist;
+			}
+		}
+		if (geo_found[i].first->val.GetInd() != expected || geo_found[i].second != expected_dist)
+			std::cout << i + 1 << "-th haversine vptree query didn't match." << std::endl;
+	}
+}
+
+void deadline_check(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
+{
+	KdTree<ValType> root(test_data.data(), test_data.size());
+	for (long long budget : { 1000000LL, 20000LL })
+	{
+		Timer<> timer;
+		auto deadline = QueryDeadline::Nodes(budget);
+		auto found = root.QueryBatchWithin(query_data.data(), query_data.size(), deadline);
+		timer.EndTimer("TIME FOR KDTREE DEADLINE QUERYING (" + std::to_string(budget) + " NODES): ");
+
+		int inexact = 0;
+		for (int i = 0; i < query_data.size(); ++i)
+		{
+			if (!found[i].exact)
+			{
+				++inexact;
+				continue;
+			}
+			if (std::abs(found[i].second - root.Query(query_data[i]).second) > 1e-6)
+				std::cout << i + 1 << "-th deadline query claimed exact but didn't match." << std::endl;
+		}
+		std::cout << "deadline queries not exact: " << inexact << std::endl;
+	}
+}
+
+void snapshot_check(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
+{
+	KdTree<ValType> reference(test_data.data(), test_data.size());
+	std::vector<double> expected;
+	for (int i = 0; i < query_data.size(); ++i)
+		expected.push_back(reference.Query(query_data[i]).second);
+
+	KdTreeSnapshot<ValType> index;
+	index.Rebuild(test_data);
+
+	//߳оɰ汾ڼؽ, ɰ汾Ӧһͷʱ
+	auto held = index.Acquire();
+	index.Rebuild(test_data);
+	if (index.RetiredCount() != 1)
+		std::cout << "snapshot was reclaimed while still read." << std::endl;
+	//ƶֵͷԭȳеľɰ汾, ں̨߳첽
+	held = index.Acquire();
+	auto reclaim_start = std::chrono::steady_clock::now();
+	while (index.RetiredCount() != 0 && std::chrono::steady_clock::now() - reclaim_start < std::chrono::seconds(1))
+		std::this_thread::yield();
+	if (index.RetiredCount() != 0)
+		std::cout << "snapshot wasn't reclaimed after its last reader." << std::endl;
+	if (held.Epoch() != index.Epoch())
+		std::cout << "snapshot reader assignment didn't take the current version." << std::endl;
+	held.Release();
+
+	//ͬʱеĶ߳һۿ
+	std::vector<KdTreeSnapshot<ValType>::Reader> readers;
+	for (int i = 0; i < 300; ++i)
+		readers.push_back(index.Acquire());
+	if (std::any_of(readers.begin(), readers.end(), [](const KdTreeSnapshot<ValType>::Reader& reader) { return !reader; }))
+		std::cout << "snapshot acquire failed with many readers." << std::endl;
+	readers.erase(readers.begin(), readers.begin() + 100);
+	readers.clear();
+
+	std::atomic<bool> done{ false };
+	std::thread rebuilder([&] { while (!done) index.Rebuild(test_data); });
+	Timer<> timer;
+	for (int i = 0; i < query_data.size(); ++i)
+	{
+		auto snap = index.Acquire();
+		if (std::abs(snap->Query(query_data[i]).second - expected[i]) > 1e-6)
+			std::cout << i + 1 << "-th snapshot query didn't match." << std::endl;
+	}
+	timer.EndTimer("TIME FOR SNAPSHOT QUERYING DURING REBUILDS: ");
+	done = true;
+	rebuilder.join();
+	std::cout << "snapshot rebuilds during querying: " << index.Epoch() - 2 << ", not reclaimed: " << index.Reclaim() << std::endl;
+}
+
+template<int Dims>
+void graph_check(int size, int k)
+{
+	using GraphValType = DataType<double, Dims>;
+	std::vector<typename GraphValType::data_type> points(size);
+	for (auto& point : points)
+		for (auto& value : point)
+			value = rand() % mod_n;
+
+	Timer<> timer;
+	KdTree<GraphValType> root(points.data(), size);
+	KnnGraph graph = root.BuildKnnGraph(k);
+	timer.EndTimer("TIME FOR KNN GRAPH BUILDING (" + std::to_string(Dims) + "D): ");
+
+	//뱩Ƚ, ȥ
+	BruteForceIndex<GraphValType> reference(points.data(), size);
+	for (int i = 0; i < size; i += 97)
+	{
+		auto expected = reference.QueryKnn(points[i], k + 1);
+		auto self = std::find_if(expected.begin(), expected.end(),
+			[i](const typename BruteForceIndex<GraphValType>::ResultType& item) { return item.first->val.GetInd() == i; });
+		expected.erase(self != expected.end() ? self : expected.end() - 1);
+
+		bool matched = graph.offsets[i + 1] - graph.offsets[i] == expected.size();
+		for (size_t j = 0; matched && j < expected.size(); ++j)
+		{
+			size_t edge = graph.offsets[i] + j;
+			matched = graph.indices[edge] == expected[j].first->val.GetInd() && std::abs(std::sqrt(graph.sq_dists[edge]) - expected[j].second) < 1e-6;
+		}
+		if (!matched)
+			std::cout << i + 1 << "-th knn graph row (" << Dims << "D) didn't match." << std::endl;
+	}
+}
+
+//: Ѳƽŵ͵ĴΧ, ƽԶ double ľȷΧ, ȵ
+template<typename ty>
+void exact_check(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data, int shift, const std::string& name)
+{
+	using ExactValType = DataType<ty, nn>;
+	auto convert = [shift](const std::vector<ValMemType>& points)
+	{
+		std::vector<typename ExactValType::data_type> ret(points.size());
+		for (int i = 0; i < points.size(); ++i)
+			for (int dim = 0; dim < nn; ++dim)
+				ret[i][dim] = ((ty)points[i][dim] - mod_n / 2) * ((ty)1 << shift);
+		return ret;
+	};
+	auto points = convert(test_data), queries = convert(query_data);
+
+	Timer<> timer;
+	KdTree<ExactValType> root(points.data(), points.size());
+	std::vector<decltype(root.QueryExact(queries[0]))> found;
+	for (int i = 0; i < queries.size(); ++i)
+		found.push_back(root.QueryExact(queries[i]));
+	timer.EndTimer("TIME FOR KDTREE EXACT QUERYING (" + name + "): ");
+
+	BruteForceIndex<ExactValType> reference(points.data(), points.size());
+	for (int i = 0; i < queries.size(); ++i)
+	{
+		auto expected = reference.QueryExact(queries[i]);
+		if (found[i].first->val.GetInd() != expected.first->val.GetInd() || !(found[i].second == expected.second))
+			std::cout << i + 1 << "-th exact query (" << name << ") didn't match." << std::endl;
+	}
+}
+
+void numa_check(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
+{
+	KdTree<ValType> reference(test_data.data(), test_data.size());
+	auto check = [&](const NumaKdTree<ValType>& index, const std::string& name)
+	{
+		Timer<> timer;
+		auto found = index.QueryBatch(query_data.data(), query_data.size());
+		timer.EndTimer("TIME FOR NUMA BATCH QUERYING (" + name + "): ");
+		auto few = index.QueryBatch(query_data.data(), 10);
+		for (int i = 0; i < query_data.size(); ++i)
+		{
+			auto expected = reference.Query(query_data[i]);
+			if (found[i].first->val.GetInd() != expected.first->val.GetInd() || (i < few.size() && few[i].first->val.GetInd() != expected.first->val.GetInd()))
+				std::cout << i + 1 << "-th numa query (" << name << ") didn't match." << std::endl;
+		}
+	};
+
+	NumaKdTree<ValType> detected(test_data.data(), test_data.size());
+	std::cout << "numa nodes: " << detected.NodeCount() << std::endl;
+	check(detected, "DETECTED");
+
+	// CPU 0 ϵĽڵһսڵ, κλ߶ั·
+	NumaTopology topology;
+	topology.node_cpus = { { 0 }, {}, { 0 } };
+	NumaKdTree<ValType> replicated(test_data.data(), test_data.size(), NodeLayout::DepthFirst, topology);
+	if (replicated.NodeCount() != 2)
+		std::cout << "numa topology with an empty node wasn't normalized." << std::endl;
+	check(replicated, "2 REPLICAS");
+}
+
+//ȵָʽ, ֱӰͳƵĵ㼯Ƚ; ͶӰ, ˹⵹
+void export_check(const std::vector<ValMemType>& test_data)
+{
+	KdTree<ValType> root(test_data.data(), test_data.size());
+	const std::string path = "kdtree_export_check.tmp";
+	const int limited_depth = 8;
+	ExportOptions opt;
+	opt.projection = { { 1, 0 } };
+	opt.x_range = { { mod_n * 0.6, mod_n * 0.2 } };
+	opt.y_range = { { mod_n * 0.5, mod_n * 0.1 } };
+	auto inside = [](const ValMemType& point)
+	{
+		return point[1] >= mod_n * 0.2 && point[1] <= mod_n * 0.6 && point[0] >= mod_n * 0.1 && point[0] <= mod_n * 0.5;
+	};
+	auto read_file = [&path]()
+	{
+		std::ifstream is(path, std::ios::binary);
+		return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+	};
+
+	//Ƽ¼еĵ: ¼Ȳ limitԭһ, 򷵻 false
+	const size_t header_size = 4 * sizeof(std::int32_t), record_size = sizeof(std::int32_t) + 2 + sizeof(std::uint16_t) + nn * sizeof(double);
+	auto parse_binary = [&](const std::string& bytes, int limit, std::array<std::int32_t, 2> projection, std::vector<int>& records)
+	{
+		std::int32_t header[4] = {};
+		if (bytes.size() < header_size || (bytes.size() - header_size) % record_size != 0)
+			return false;
+		std::memcpy(header, bytes.data(), header_size);
+		if (header[0] != 0x3154444b || header[1] != nn || header[2] != projection[0] || header[3] != projection[1])
+			return false;
+		for (size_t offset = header_size; offset < bytes.size(); offset += record_size)
+		{
+			std::int32_t ind;
+			std::uint16_t level;
+			ValMemType point;
+			std::memcpy(&ind, bytes.data() + offset, sizeof(ind));
+			std::memcpy(&level, bytes.data() + offset + sizeof(ind) + 2, sizeof(level));
+			std::memcpy(point.data(), bytes.data() + offset + record_size - nn * sizeof(double), nn * sizeof(double));
+			if (ind < 0 || ind >= test_data.size() || level > limit || point != test_data[ind])
+				return false;
+			records.push_back(ind);
+		}
+		return true;
+	};
+
+	//ʱڵĵ㶼Ӧ,  Matlab עõ, ڼȵĵ
+	std::vector<int> depth(test_data.size(), -1);
+	for (int limit : { std::numeric_limits<int>::max(), limited_depth })
+	{
+		opt.max_depth = limit;
+		std::vector<int> expected;
+		for (int i = 0; i < test_data.size(); ++i)
+		{
+			if (inside(test_data[i]) && (limit != limited_depth || depth[i] <= limit))
+				expected.push_back(i);
+		}
+		const std::string depth_name = limit == limited_depth ? "DEPTH " + std::to_string(limit) : "ALL DEPTHS";
+
+		for (auto format : { ExportFormat::Matlab, ExportFormat::Svg })
+		{
+			const bool matlab = format == ExportFormat::Matlab;
+			opt.format = format;
+			root.Export(path, opt);
+			std::istringstream content(read_file());
+
+			//ÿһ, עΪ "±_", Matlab д text , Svg д title 
+			const std::string point_tag = matlab ? "scatter(" : "<circle";
+			size_t points = 0;
+			std::vector<int> found;
+			for (std::string line; std::getline(content, line);)
+			{
+				if (line.compare(0, point_tag.size(), point_tag) == 0)
+					++points;
+				size_t label = matlab ? (line.compare(0, 5, "text(") == 0 ? line.find('\'') : std::string::npos) : line.find("<title>");
+				if (label == std::string::npos)
+					continue;
+				int ind = -1, level = -1;
+				char separator;
+				std::istringstream(line.substr(label + (matlab ? 1 : 7))) >> ind >> separator >> level;
+				if (ind < 0 || ind >= test_data.size() || level > limit)
+				{
+					std::cout << "export (" << (matlab ? "MATLAB, " : "SVG, ") << depth_name << ") has a bad label: " << line << std::endl;
+					continue;
+				}
+				if (matlab && limit != limited_depth)
+					depth[ind] = level;
+				found.push_back(ind);
+			}
+			std::sort(found.begin(), found.end());
+			if (points != found.size() || found != expected)
+				std::cout << "export (" << (matlab ? "MATLAB, " : "SVG, ") << depth_name << ") didn't match: "
+					<< points << " points, " << expected.size() << " in region." << std::endl;
+		}
+
+		//ƵбʵĽڵ(), ֻȽڵĲ
+		opt.format = ExportFormat::Binary;
+		root.Export(path, opt);
+		std::vector<int> records, found;
+		bool valid = parse_binary(read_file(), limit, { { 1, 0 } }, records);
+		for (int ind : records)
+		{
+			if (inside(test_data[ind]))
+				found.push_back(ind);
+		}
+		std::sort(found.begin(), found.end());
+		if (!valid || found != expected)
+			std::cout << "export (BINARY, " << depth_name << ") didn't match: "
+				<< found.size() << " of " << records.size() << " records in region, " << expected.size() << " expected." << std::endl;
+	}
+	std::remove(path.c_str());
+
+	//Ĭѡ, ͶӰȡά 0  1
+	std::ostringstream whole;
+	root.Export(whole, [] { ExportOptions opt; opt.format = ExportFormat::Binary; return opt; }());
+	std::vector<int> records;
+	if (!parse_binary(whole.str(), std::numeric_limits<int>::max(), { { 0, 1 } }, records) || records.size() != test_data.size())
+		std::cout << "export (BINARY, WHOLE TREE) didn't match: " << records.size() << " records." << std::endl;
+}
+
+//ֻ֡ͬƬ뱩Ƚ k ڵ±, ѯͬʱؽƬ
+void shard_check(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
+{
+	const int k = 8;
+	const int stride = std::max<int>(1, query_data.size() / 2000); //k ֻһֲѯ, ǰ붼ȡ
+	BruteForceIndex<ValType> brute(test_data.data(), test_data.size());
+	KdTree<ValType> reference(test_data.data(), test_data.size());
+
+	const std::pair<ShardPartition, std::string> partitions[] = {
+		{ ShardPartition::Spatial, "SPATIAL" },
+		{ ShardPartition::Hash, "HASH" },
+	};
+	for (const auto& partition : partitions)
+	{
+		for (int shard_count : { 1, 3, 8 })
+		{
+			const std::string name = partition.second + ", " + std::to_string(shard_count) + " SHARDS";
+			Timer<> timer;
+			ShardedKdTree<ValType> index(test_data.data(), test_data.size(), shard_count, partition.first);
+			timer.EndTimer("TIME FOR SHARDED KDTREE BUILDING (" + name + "): ");
+			if (index.ShardCount() != shard_count)
+				std::cout << "sharded kdtree (" << name << ") has " << index.ShardCount() << " shards." << std::endl;
+
+			for (int i = 0; i < query_data.size(); i += stride)
+			{
+				auto found = index.QueryKnn(query_data[i], k);
+				auto expected = brute.QueryKnn(query_data[i], k);
+				bool same = found.size() == expected.size();
+				for (size_t j = 0; same && j < found.size(); ++j)
+					same = found[j].first.GetInd() == expected[j].first->val.GetInd() && found[j].second == expected[j].second;
+				if (!same)
+					std::cout << i + 1 << "-th sharded knn query (" << name << ") didn't match." << std::endl;
+			}
+
+			//ؽֻ滻Ƭе, 㼯, Ӧ뵥һ
+			std::atomic<bool> done{ false };
+			int rebuilds = 0;
+			std::thread rebuilder([&] { for (; !done; ++rebuilds) index.RebuildShard(rebuilds % shard_count); });
+			timer.StartTimer();
+			auto batch = index.QueryBatch(query_data.data(), query_data.size(), 2);
+			timer.EndTimer("TIME FOR SHARDED KDTREE BATCH QUERYING DURING REBUILDS (" + name + "): ");
+			done = true;
+			rebuilder.join();
+			for (int i = 0; i < query_data.size(); ++i)
+			{
+				auto expected = reference.Query(query_data[i]);
+				if (batch[i].first.GetInd() != expected.first->val.GetInd() || batch[i].second != expected.second)
+					std::cout << i + 1 << "-th sharded batch query (" << name << ") didn't match." << std::endl;
+			}
+			std::cout << "sharded rebuilds during querying (" << name << "): " << rebuilds << std::endl;
+		}
+	}
+}
+
+
 std::vector<ValType> run_flann(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
 {
 	Matrix<float> dataset(new float[data_size*nn], data_size, nn);
@@ -97,6 +662,22 @@ std::vector<ValType> run_flann(const std::vector<ValMemType>& test_data, const s
 
 	return ret;
 }
+std::vector<ValType> run_bruteforce(const std::vector<ValMemType>& test_data, const std::vector<ValMemType>& query_data)
+{
+	Timer<> timer;
+	BruteForceIndex<ValType> index(test_data.data(), test_data.size());
+	timer.EndTimer("BRUTE FORCE BUILD TIME:");
+
+	timer.StartTimer();
+	auto found = index.QueryBatch(query_data.data(), query_data.size());
+	timer.EndTimer("BRUTE FORCE QUERY TIME:");
+
+	std::vector<ValType> ret;
+	for (const auto& item : found)
+		ret.push_back(item.first->val);
+	return ret;
+}
+
 
 int main()
 {
@@ -106,8 +687,23 @@ int main()
 	std::cout << "data size: \t" << test_data.size() << std::endl;
 	std::cout << "query size: \t" << query_data.size() << std::endl;
 
-	std::vector<ValType> ret_ref = run_flann(test_data, query_data);
+	run_flann(test_data, query_data);
+	std::vector<ValType> ret_ref = run_bruteforce(test_data, query_data);
 	std::vector<ValType> ret = mine_check(test_data, query_data);
+	export_check(test_data);
+	layout_check(test_data, query_data);
+	builder_check(test_data, query_data);
+	exact_check<std::int32_t>(test_data, query_data, 21, "INT32");
+	exact_check<std::int64_t>(test_data, query_data, 52, "INT64");
+	filter_check(test_data, query_data);
+	vptree_check(test_data, query_data);
+	deadline_check(test_data, query_data);
+	snapshot_check(test_data, query_data);
+	shard_check(test_data, query_data);
+	numa_check(test_data, query_data);
+	graph_check<2>(data_size, 8);
+	graph_check<3>(data_size, 8);
+	graph_check<8>(data_size / 10, 8);
 
 	KdTree<ValType> root(test_data.data(), test_data.size());
 	Timer<> timer;
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+#include "kdtree.h"
+//////////////////////////////////////////////////
+//  vantage-point ,  KdTree ʹͬĵѯӿ
+//    ÿڲڵȡһ vantage , 㰴ľλ mu Ϊ
+//    ѯֻǲʽ֦, Ҫֽ, άͨڰָ֦
+//    ڵ㰴, ҶΪŵĵͰ; ʱϲɶ̲߳д
+// 磺
+//    VpTree<ValType, HaversineMetric> geo(data, size);   // data[i] = { γ,  }()
+//    auto ret = geo.Query(item);      // ret.first->val, ret.second Ϊ()
+//=======================
+//    Metric ǲʽ, ѯܲ
+//
+
+//ŷϾ
+struct EuclideanMetric
+{
+	template<typename data_type>
+	double operator()(const data_type& a, const data_type& b) const
+	{
+		double ret = 0;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			double diff = (double)a[i] - (double)b[i];
+			ret += diff * diff;
+		}
+		return std::sqrt(ret);
+	}
+};
+
+//Բ, ǰάΪγ뾭(), λ radius ͬ
+struct HaversineMetric
+{
+	double radius = 6371008.8; //ƽ뾶()
+
+	template<typename data_type>
+	double operator()(const data_type& a, const data_type& b) const
+	{
+		const double to_rad = 3.14159265358979323846 / 180;
+		double lat1 = a[0] * to_rad, lat2 = b[0] * to_rad;
+		double sin_lat = std::sin((lat2 - lat1) / 2), sin_lon = std::sin(((double)b[1] - (double)a[1]) * to_rad / 2);
+		double h = sin_lat * sin_lat + std::cos(lat1) * std::cos(lat2) * sin_lon * sin_lon;
+		return 2 * radius * std::asin(std::sqrt(std::min(1.0, h)));
+	}
+};
+
+//н(), ޹; κļнǰ pi/2 
+struct AngularMetric
+{
+	template<typename data_type>
+	double operator()(const data_type& a, const data_type& b) const
+	{
+		double dot = 0, norm_a = 0, norm_b = 0;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			dot += (double)a[i] * b[i];
+			norm_a += (double)a[i] * a[i];
+			norm_b += (double)b[i] * b[i];
+		}
+		double norm = std::sqrt(norm_a * norm_b);
+		return std::acos(norm > 0 ? std::max(-1.0, std::min(1.0, dot / norm)) : 0.0);
+	}
+};
+
+template<typename ValType, typename Metric = EuclideanMetric>
+class VpTree
+{
+public:
+	typedef typename ValType::data_type data_type;
+	// KdNode һͨ ->val ȡõ
+	struct ItemType
+	{
+		ValType val;
+	};
+	typedef std::pair<const ItemType*, double> ResultType;
+
+	VpTree() = default;
+	//threads <= 0 ʱȡӲ߳
+	VpTree(const data_type data[], int size, Metric Dist = Metric(), int threads = 0)
+		:metric(std::move(Dist))
+	{
+		points.reserve(size);
+		for (int i = 0; i < size; ++i)
+			points.push_back(ItemType{ ValType(data, i) });
+		nodes.resize(CountNodes(size));
+
+		if (threads <= 0)
+			threads = std::max(1, (int)std::thread::hardware_concurrency());
+		int parallel_levels = 0;
+		while ((1 << parallel_levels) < threads)
+			++parallel_levels;
+		if (size > 0)
+			BuildNode(0, 0, size, parallel_levels);
+	}
+
+	//ʱ±Сĵ
+	ResultType Query(const data_type& item) const
+	{
+		ResultType best(nullptr, std::numeric_limits<double>::max());
+		if (!nodes.empty())
+			QueryNode(0, item, best);
+		if (!best.first)
+			best.second = -1;
+		return best;
+	}
+
+	//ѯֿ threads ̲߳д, threads <= 0 ʱȡӲ߳
+	std::vector<ResultType> QueryBatch(const data_type items[], int size, int threads = 0) const
+	{
+		std::vector<ResultType> ret(size);
+		ParallelChunks(size, 256, threads, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; ++i)
+				ret[i] = Query(items[i]);
+		});
+		return ret;
+	}
+
+	//(ʱ±) k 
+	std::vector<ResultType> QueryKnn(const data_type& item, int k) const
+	{
+		std::vector<std::pair<double, const ItemType*>> heap;
+		if (k > 0 && !nodes.empty())
+			QueryKnnNode(0, item, heap, k);
+
+		std::sort_heap(heap.begin(), heap.end(), KnnLess);
+		std::vector<ResultType> ret;
+		for (const auto& dist_item : heap)
+			ret.emplace_back(dist_item.second, dist_item.first);
+		return ret;
+	}
+
+	int size() const
+	{
+		return (int)points.size();
+	}
+
+private:
+	constexpr static int LeafSize = 16;
+	constexpr static int ParallelMinSize = 1 << 14;
+
+	//ڲڵ: points[begin] Ϊ vantage , ڲΪһڵ,  [begin + 1, begin + 1 + inside_size)
+	//и㵽 vantage ľ벻 mu, λ nodes[outside], 벻С mu
+	//Ҷڵ: outside < 0, ͰΪ [begin, end)
+	struct Node
+	{
+		int begin, end;
+		int outside;
+		double mu;
+	};
+
+	Metric metric;
+	std::vector<ItemType> points;
+	std::vector<Node> nodes;
+
+	static int InsideSize(int size)
+	{
+		return (size - 1) / 2;
+	}
+
+	//ڵֻɵ, еλÿڽǰ, ڲд
+	static size_t CountNodes(int size)
+	{
+		if (size <= 0)
+			return 0;
+		if (size <= LeafSize)
+			return 1;
+		return 1 + CountNodes(InsideSize(size)) + CountNodes(size - 1 - InsideSize(size));
+	}
+
+	double Distance(const data_type& item, const ItemType& target) const
+	{
+		return metric(item, target.val.getData());
+	}
+
+	void BuildNode(size_t index, int begin, int end, int parallel_levels)
+	{
+		Node& node = nodes[index];
+		node.begin = begin;
+		node.end = end;
+		node.outside = -1;
+		node.mu = 0;
+		if (end - begin <= LeafSize)
+			return;
+
+		std::swap(points[begin], points[ChooseVantage(begin, end)]);
+		const data_type& vantage = points[begin].val.getData();
+		std::vector<std::pair<double, ItemType>> by_dist;
+		by_dist.reserve(end - begin - 1);
+		for (int i = begin + 1; i < end; ++i)
+			by_dist.emplace_back(Distance(vantage, points[i]), points[i]);
+
+		const int inside = InsideSize(end - begin);
+		auto nth = by_dist.begin() + inside;
+		std::nth_element(by_dist.begin(), nth, by_dist.end(),
+			[](const std::pair<double, ItemType>& l, const std::pair<double, ItemType>& r) { return l.first < r.first; });
+		node.mu = nth->first;
+		for (size_t i = 0; i < by_dist.size(); ++i)
+			points[begin + 1 + i] = by_dist[i].second;
+
+		const int middle = begin + 1 + inside;
+		node.outside = (int)(index + 1 + CountNodes(inside));
+		if (parallel_levels > 0 && end - begin >= ParallelMinSize)
+		{
+			std::thread worker([&] { BuildNode(index + 1, begin + 1, middle, parallel_levels - 1); });
+			BuildNode(node.outside, middle, end, parallel_levels - 1);
+			worker.join();
+		}
+		else
+		{
+			BuildNode(index + 1, begin + 1, middle, 0);
+			BuildNode(node.outside, middle, end, 0);
+		}
+	}
+
+	//ѡѡ뷽, ʹྡֿ
+	int ChooseVantage(int begin, int end) const
+	{
+		const int candidates = 5, samples = 32;
+		std::minstd_rand rng(begin * 2654435761u + end);
+		std::uniform_int_distribution<int> pick(begin, end - 1);
+
+		int best = begin;
+		double best_spread = -1;
+		for (int c = 0; c < candidates; ++c)
+		{
+			int candidate = pick(rng);
+			double sum = 0, sum_sq = 0;
+			for (int s = 0; s < samples; ++s)
+			{
+				double dist = Distance(points[candidate].val.getData(), points[pick(rng)]);
+				sum += dist;
+				sum_sq += dist * dist;
+			}
+			double spread = sum_sq / samples - (sum / samples) * (sum / samples);
+			if (spread > best_spread)
+			{
+				best_spread = spread;
+				best = candidate;
+			}
+		}
+		return best;
+	}
+
+	static bool IsCloser(double dist, const ItemType* item, const ResultType& best)
+	{
+		return dist < best.second || (dist == best.second && best.first && item->val.GetInd() < best.first->val.GetInd());
+	}
+
+	void QueryNode(size_t index, const data_type& item, ResultType& best) const
+	{
+		const Node& node = nodes[index];
+		if (node.outside < 0)
+		{
+			for (int i = node.begin; i < node.end; ++i)
+			{
+				double dist = Distance(item, points[i]);
+				if (IsCloser(dist, &points[i], best))
+					best = ResultType(&points[i], dist);
+			}
+			return;
+		}
+
+		double dist = Distance(item, points[node.begin]);
+		if (IsCloser(dist, &points[node.begin], best))
+			best = ResultType(&points[node.begin], dist);
+
+		//Ƚѯһ; һֻԵǰΪ뾶ཻ֮()ʱ
+		if (dist < node.mu)
+		{
+			QueryNode(index + 1, item, best);
+			if (dist + best.second >= node.mu)
+				QueryNode(node.outside, item, best);
+		}
+		else
+		{
+			QueryNode(node.outside, item, best);
+			if (dist - best.second <= node.mu)
+				QueryNode(index + 1, item, best);
+		}
+	}
+
+	static bool KnnLess(const std::pair<double, const ItemType*>& l, const std::pair<double, const ItemType*>& r)
+	{
+		return l.first < r.first || (l.first == r.first && l.second->val.GetInd() < r.second->val.GetInd());
+	}
+
+	void Offer(std::vector<std::pair<double, const ItemType*>>& heap, size_t k, double dist, const ItemType* target) const
+	{
+		auto candidate = std::make_pair(dist, target);
+		if (heap.size() < k)
+		{
+			heap.push_back(candidate);
+			std::push_heap(heap.begin(), heap.end(), KnnLess);
+		}
+		else if (KnnLess(candidate, heap.front()))
+		{
+			std::pop_heap(heap.begin(), heap.end(), KnnLess);
+			heap.back() = candidate;
+			std::push_heap(heap.begin(), heap.end(), KnnLess);
+		}
+	}
+
+	void QueryKnnNode(size_t index, const data_type& item, std::vector<std::pair<double, const ItemType*>>& heap, size_t k) const
+	{
+		const Node& node = nodes[index];
+		if (node.outside < 0)
+		{
+			for (int i = node.begin; i < node.end; ++i)
+				Offer(heap, k, Distance(item, points[i]), &points[i]);
+			return;
+		}
+
+		double dist = Distance(item, points[node.begin]);
+		Offer(heap, k, dist, &points[node.begin]);
+		auto radius = [&heap, k]() { return heap.size() < k ? std::numeric_limits<double>::max() : heap.front().first; };
+		if (dist < node.mu)
+		{
+			QueryKnnNode(index + 1, item, heap, k);
+			if (dist + radius() >= node.mu)
+				QueryKnnNode(node.outside, item, heap, k);
+		}
+		else
+		{
+			QueryKnnNode(node.outside, item, heap, k);
+			if (dist - radius() <= node.mu)
+				QueryKnnNode(index + 1, item, heap, k);
+		}
+	}
+};